@@ -0,0 +1,709 @@
+/* © 2025 David Given.
+ * WordGrinder is licensed under the MIT open source license. See the COPYING
+ * file in this distribution for the full text.
+ */
+
+#include "globals.h"
+#include <string.h>
+#include <limits.h>
+#include <algorithm>
+#include <string_view>
+#include <unordered_map>
+
+/* A native loader for the v3 text dumpfile format, which is what
+ * loadfromstreamt() in fileio.lua used to do line by line with Lua patterns.
+ * It must behave exactly the same on every file the Lua loader accepted.
+ *
+ * The file consists of property lines, which look like:
+ *
+ *   .documents.1.name: "Document"
+ *
+ * and paragraph blocks, which look like:
+ *
+ *   #1
+ *   P word word word
+ *   .
+ *
+ * The v4 binary dumpfile is further down.
+ */
+
+static bool isdigits(std::string_view s)
+{
+    if (s.empty())
+        return false;
+    for (char c : s)
+        if ((c < '0') || (c > '9'))
+            return false;
+    return true;
+}
+
+/* Pushes the result of Lua's tonumber() on a string, which may be nil. */
+static void pushtonumber(lua_State* L, std::string_view s)
+{
+    lua_pushlstring(L, s.data(), s.size());
+    int isnum;
+    double d = lua_tonumberx(L, -1, &isnum);
+    lua_pop(L, 1);
+    if (isnum)
+        lua_pushnumber(L, d);
+    else
+        lua_pushnil(L);
+}
+
+static void pushkey(lua_State* L, std::string_view s)
+{
+    if (isdigits(s))
+        pushtonumber(L, s);
+    else
+        lua_pushlstring(L, s.data(), s.size());
+}
+
+/* Matches ^-?[0-9][0-9.e+-]*$. */
+static bool isnumeric(std::string_view s)
+{
+    size_t i = 0;
+    if ((i < s.size()) && (s[i] == '-'))
+        i++;
+    if ((i == s.size()) || (s[i] < '0') || (s[i] > '9'))
+        return false;
+    for (i++; i < s.size(); i++)
+    {
+        char c = s[i];
+        if (!(((c >= '0') && (c <= '9')) || (c == '.') || (c == 'e') ||
+                (c == '+') || (c == '-')))
+            return false;
+    }
+    return true;
+}
+
+[[noreturn]] static void malformedline(lua_State* L, std::string_view line)
+{
+    luaL_error(L,
+        "malformed line when reading file: '%.*s'",
+        (int)line.size(),
+        line.data());
+}
+
+/* Emulates ^(.*)%.([^.:]+): (.*)$, finding the rightmost split which
+ * works. */
+static bool splitproperty(std::string_view line,
+    std::string_view& k,
+    std::string_view& p,
+    std::string_view& v)
+{
+    for (size_t dot = line.rfind('.'); dot != std::string_view::npos;
+         dot = dot ? line.rfind('.', dot - 1) : std::string_view::npos)
+    {
+        size_t end = line.find_first_of(".:", dot + 1);
+        if ((end == std::string_view::npos) || (end == dot + 1) ||
+            (line[end] != ':') || (end + 1 == line.size()) ||
+            (line[end + 1] != ' '))
+            continue;
+
+        k = line.substr(0, dot);
+        p = line.substr(dot + 1, end - dot - 1);
+        v = line.substr(end + 2);
+        return true;
+    }
+    return false;
+}
+
+/* Sets the property described by a property line, in the documentset at
+ * stack index documentset, creating documents with the function at
+ * createdocument. */
+static void setproperty(lua_State* L,
+    std::string_view line,
+    int documentset,
+    int createdocument)
+{
+    std::string_view k, p, v;
+    if (!splitproperty(line, k, p, v))
+        malformedline(L, line);
+
+    /* Walk (and create) the tables on the key path. */
+
+    lua_getfield(L, documentset, "documents");
+    int documents = lua_gettop(L);
+    lua_pushvalue(L, documentset);
+    size_t i = 0;
+    while (i < k.size())
+    {
+        size_t end = k.find('.', i);
+        if (end == std::string_view::npos)
+            end = k.size();
+        std::string_view e = k.substr(i, end - i);
+        i = end + 1;
+        if (e.empty())
+            continue;
+
+        pushkey(L, e);
+        lua_pushvalue(L, -1);
+        lua_gettable(L, -3);
+        if (!lua_toboolean(L, -1))
+        {
+            lua_pop(L, 1);
+            if (lua_rawequal(L, -2, documents))
+            {
+                lua_pushvalue(L, createdocument);
+                lua_call(L, 0, 1);
+            }
+            else
+                lua_newtable(L);
+
+            lua_pushvalue(L, -2);
+            lua_pushvalue(L, -2);
+            lua_settable(L, -5);
+        }
+
+        /* Replace the parent and key with the child. */
+        lua_replace(L, -3);
+        lua_pop(L, 1);
+    }
+
+    pushkey(L, p);
+
+    if (isnumeric(v))
+        pushtonumber(L, v);
+    else if (v == "true")
+        lua_pushboolean(L, true);
+    else if (v == "false")
+        lua_pushboolean(L, false);
+    else if ((v.size() >= 2) && (v.front() == '"') && (v.back() == '"'))
+    {
+        /* Copied so that it's terminated exactly as a Lua string would be;
+         * unescaping a trailing backslash reads the terminator. */
+        std::string s(v.substr(1, v.size() - 2));
+        s = unescapestring(s.c_str(), s.size());
+        lua_pushlstring(L, s.data(), s.size());
+    }
+    else
+        luaL_error(L,
+            "malformed property %.*s.%.*s: %.*s",
+            (int)k.size(),
+            k.data(),
+            (int)p.size(),
+            p.data(),
+            (int)v.size(),
+            v.data());
+
+    lua_settable(L, -3);
+    lua_settop(L, documents - 1);
+}
+
+/* Adds a paragraph to the document on the top of the stack. */
+static void addparagraph(
+    lua_State* L, std::string_view line, int index, int paragraphclass)
+{
+    /* This is SplitString(line, " "): the first field is the style and the
+     * rest are words, any of which may be empty. */
+
+    int words = 0;
+    for (char c : line)
+        if (c == ' ')
+            words++;
+
+    lua_createtable(L, words, 1);
+
+    size_t i = 0;
+    size_t end = line.find(' ');
+    if (end == std::string_view::npos)
+        end = line.size();
+    lua_pushlstring(L, line.data(), end);
+    lua_setfield(L, -2, "style");
+
+    for (int wn = 1; wn <= words; wn++)
+    {
+        i = end + 1;
+        end = line.find(' ', i);
+        if (end == std::string_view::npos)
+            end = line.size();
+        lua_pushlstring(L, line.data() + i, end - i);
+        lua_rawseti(L, -2, wn);
+    }
+
+    lua_pushvalue(L, paragraphclass);
+    lua_setmetatable(L, -2);
+
+    lua_pushinteger(L, index);
+    lua_insert(L, -2);
+    lua_settable(L, -3);
+}
+
+/* Returns the next line, with any carriage returns removed, or false at the
+ * end of the data (like CreateIStream's read("*l")). */
+static bool readline(const char*& ptr,
+    const char* end,
+    std::string& buffer,
+    std::string_view& line)
+{
+    if (ptr == end)
+        return false;
+
+    const char* nl = (const char*)memchr(ptr, '\n', end - ptr);
+    const char* lineend = nl ? nl : end;
+    line = std::string_view(ptr, lineend - ptr);
+    ptr = nl ? (nl + 1) : end;
+
+    if (line.find('\r') != std::string_view::npos)
+    {
+        buffer.clear();
+        for (char c : line)
+            if (c != '\r')
+                buffer += c;
+        line = buffer;
+    }
+    return true;
+}
+
+/* Reads paragraph lines, up to a "." line or the end of the data, into the
+ * document on the top of the stack. Only paragraphs first..last are parsed;
+ * the others are set to the placeholder at stack index placeholder, or left
+ * alone if it's 0. */
+static void loadparagraphs(lua_State* L,
+    const char*& ptr,
+    const char* end,
+    std::string& buffer,
+    int paragraphclass,
+    int first = 1,
+    int last = INT_MAX,
+    int placeholder = 0)
+{
+    std::string_view line;
+    int index = 1;
+    while (readline(ptr, end, buffer, line) && (line != "."))
+    {
+        if ((index >= first) && (index <= last))
+            addparagraph(L, line, index, paragraphclass);
+        else if (placeholder)
+        {
+            lua_pushvalue(L, placeholder);
+            lua_rawseti(L, -2, index);
+        }
+        index++;
+    }
+}
+
+/* Skips paragraph lines like loadparagraphs(), and records where they are
+ * in the document on the top of the stack so that they can be loaded later
+ * by wg.loadtextparagraphs(). The document is marked _unloaded. */
+static void skipparagraphs(lua_State* L,
+    const char* data,
+    const char*& ptr,
+    const char* end,
+    std::string& buffer)
+{
+    lua_pushnumber(L, ptr - data + 1);
+    lua_setfield(L, -2, "_sourceoffset");
+
+    std::string_view line;
+    const char* lineptr = ptr;
+    while (readline(ptr, end, buffer, line) && (line != "."))
+        lineptr = ptr;
+
+    lua_pushnumber(L, lineptr - data + 1);
+    lua_setfield(L, -2, "_sourceend");
+    lua_pushvalue(L, 1);
+    lua_setfield(L, -2, "_source");
+    lua_pushboolean(L, true);
+    lua_setfield(L, -2, "_unloaded");
+}
+
+/* Parses the body of a text dumpfile (everything after the magic line) into
+ * an existing DocumentSet. If lazy is set, the paragraphs of numbered
+ * documents are skipped, and each document gets _source, _sourceoffset and
+ * _sourceend fields saying where to find them. */
+static int loadtextdumpfile_cb(lua_State* L)
+{
+    size_t len;
+    const char* data = checkdata(L, 1, &len);
+    int offset = forceinteger(L, 2);
+    luaL_checktype(L, 3, LUA_TTABLE);    /* documentset */
+    luaL_checktype(L, 4, LUA_TFUNCTION); /* CreateDocument */
+    luaL_checktype(L, 5, LUA_TTABLE);    /* Paragraph */
+    bool lazy = lua_toboolean(L, 6);
+    lua_settop(L, 5);
+
+    const char* ptr = data + std::min<size_t>(std::max(offset - 1, 0), len);
+    const char* end = data + len;
+    std::string buffer;
+    std::string_view line;
+    while (readline(ptr, end, buffer, line))
+    {
+        if (line.empty())
+            continue;
+
+        if (line[0] == '.')
+            setproperty(L, line, 3, 4);
+        else if (line[0] == '#')
+        {
+            std::string_view id = line.substr(1);
+            if (id == "clipboard")
+            {
+                lua_getfield(L, 3, "clipboard");
+                if (!lua_toboolean(L, -1))
+                    luaL_error(L, "assertion failed!");
+                loadparagraphs(L, ptr, end, buffer, 5);
+            }
+            else
+            {
+                lua_getfield(L, 3, "documents");
+                pushtonumber(L, id);
+                if (lua_isnil(L, -1))
+                    luaL_error(L, "assertion failed!");
+                lua_gettable(L, -2);
+                lua_remove(L, -2);
+
+                if (lazy && lua_istable(L, -1))
+                    skipparagraphs(L, data, ptr, end, buffer);
+                else
+                    loadparagraphs(L, ptr, end, buffer, 5);
+            }
+
+            lua_pop(L, 1);
+        }
+        else
+            malformedline(L, line);
+    }
+
+    return 0;
+}
+
+/* Loads the paragraphs skipped by a lazy wg.loadtextdumpfile(). If first
+ * and last are given, only those paragraphs are loaded; the others are set
+ * to placeholder, if given. */
+static int loadtextparagraphs_cb(lua_State* L)
+{
+    size_t len;
+    const char* data = checkdata(L, 1, &len);
+    int offset = forceinteger(L, 2);
+    luaL_checktype(L, 3, LUA_TTABLE); /* document */
+    luaL_checktype(L, 4, LUA_TTABLE); /* Paragraph */
+    int first = lua_isnoneornil(L, 5) ? 1 : forceinteger(L, 5);
+    int last = lua_isnoneornil(L, 6) ? INT_MAX : forceinteger(L, 6);
+    bool placeholder = !lua_isnoneornil(L, 7);
+    lua_settop(L, 7);
+    lua_pushvalue(L, 3);
+
+    const char* ptr = data + std::min<size_t>(std::max(offset - 1, 0), len);
+    std::string buffer;
+    loadparagraphs(
+        L, ptr, data + len, buffer, 4, first, last, placeholder ? 7 : 0);
+    return 0;
+}
+
+/* --- Binary dumpfiles ---------------------------------------------------
+ *
+ * The v4 binary dumpfile is meant for very big document sets, and can be
+ * loaded straight out of a mapped file without any parsing. After the magic line, it's made of
+ * little-endian 32-bit numbers:
+ *
+ *   metadata size
+ *   number of strings
+ *   number of documents
+ *   for each document:
+ *     file offset of its paragraphs
+ *     number of paragraphs
+ *   metadata: the property lines of a v3 dumpfile (no paragraphs)
+ *   string table:
+ *     number of strings + 1 offsets into the string data (the last is its
+ *       size)
+ *     the string data
+ *   for each document, for each paragraph:
+ *     string number of the style
+ *     number of words
+ *     string number of each word
+ *
+ * Every distinct word and style is in the string table exactly once, and
+ * strings are numbered from zero.
+ */
+
+static const char BMAGIC[] =
+    "WordGrinder dumpfile v4: this is not a text file!\n";
+
+static uint32_t readu32(const uint8_t* p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+           ((uint32_t)p[3] << 24);
+}
+
+static void appendu32(std::string& s, uint32_t value)
+{
+    char b[4] = {(char)value,
+        (char)(value >> 8),
+        (char)(value >> 16),
+        (char)(value >> 24)};
+    s.append(b, 4);
+}
+
+static bool isbinarydumpfile(const char* data, size_t len)
+{
+    return (len >= sizeof(BMAGIC) - 1) &&
+           (memcmp(data, BMAGIC, sizeof(BMAGIC) - 1) == 0);
+}
+
+/* Reads the numbers in a binary dumpfile, checking that they're in it. */
+struct BinaryReader
+{
+    lua_State* L;
+    const uint8_t* data;
+    size_t len;
+
+    [[noreturn]] void malformed()
+    {
+        luaL_error(L, "malformed binary dumpfile");
+    }
+
+    void check(size_t offset, size_t size)
+    {
+        if ((offset > len) || (size > (len - offset)))
+            malformed();
+    }
+
+    uint32_t u32(size_t offset)
+    {
+        check(offset, 4);
+        return readu32(data + offset);
+    }
+};
+
+/* Parses a complete binary dumpfile into an existing DocumentSet. Stack:
+ * ?, documentset, createdocument, paragraph. */
+static void loadbinary(lua_State* L, const char* data, size_t len)
+{
+    BinaryReader r = {L, (const uint8_t*)data, len};
+    size_t offset = sizeof(BMAGIC) - 1;
+    uint32_t metadatasize = r.u32(offset);
+    uint32_t stringcount = r.u32(offset + 4);
+    uint32_t documentcount = r.u32(offset + 8);
+    size_t documentheaders = offset + 12;
+    size_t metadata = documentheaders + (size_t)documentcount * 8;
+    size_t stringoffsets = metadata + metadatasize;
+    size_t strings = stringoffsets + ((size_t)stringcount + 1) * 4;
+    r.check(metadata, metadatasize);
+    r.check(stringoffsets, strings - stringoffsets);
+
+    /* The metadata is the same as in a text dumpfile. */
+
+    const char* ptr = data + metadata;
+    const char* end = ptr + metadatasize;
+    std::string buffer;
+    std::string_view line;
+    while (readline(ptr, end, buffer, line))
+    {
+        if (line.empty())
+            continue;
+        if (line[0] != '.')
+            malformedline(L, line);
+        setproperty(L, line, 2, 3);
+    }
+
+    /* Each string is only made once. */
+
+    lua_createtable(L, stringcount, 0);
+    int stringtable = lua_gettop(L);
+    uint32_t stringssize = r.u32(stringoffsets + (size_t)stringcount * 4);
+    r.check(strings, stringssize);
+    for (uint32_t i = 0; i < stringcount; i++)
+    {
+        uint32_t start = r.u32(stringoffsets + (size_t)i * 4);
+        uint32_t finish = r.u32(stringoffsets + (size_t)i * 4 + 4);
+        if ((start > finish) || (finish > stringssize))
+            r.malformed();
+        lua_pushlstring(L, data + strings + start, finish - start);
+        lua_rawseti(L, stringtable, i + 1);
+    }
+
+    lua_getfield(L, 2, "documents");
+    for (uint32_t dn = 0; dn < documentcount; dn++)
+    {
+        size_t p = r.u32(documentheaders + (size_t)dn * 8);
+        uint32_t paragraphcount = r.u32(documentheaders + (size_t)dn * 8 + 4);
+
+        lua_rawgeti(L, -1, dn + 1);
+        if (!lua_istable(L, -1))
+            r.malformed();
+
+        for (uint32_t pn = 1; pn <= paragraphcount; pn++)
+        {
+            uint32_t style = r.u32(p);
+            uint32_t words = r.u32(p + 4);
+            r.check(p + 8, (size_t)words * 4);
+            if (style >= stringcount)
+                r.malformed();
+
+            lua_createtable(L, words, 1);
+            lua_rawgeti(L, stringtable, style + 1);
+            lua_setfield(L, -2, "style");
+            for (uint32_t wn = 0; wn < words; wn++)
+            {
+                uint32_t word = readu32(r.data + p + 8 + (size_t)wn * 4);
+                if (word >= stringcount)
+                    r.malformed();
+                lua_rawgeti(L, stringtable, word + 1);
+                lua_rawseti(L, -2, wn + 1);
+            }
+            lua_pushvalue(L, 4);
+            lua_setmetatable(L, -2);
+            lua_rawseti(L, -2, pn);
+
+            p += 8 + (size_t)words * 4;
+        }
+
+        lua_pop(L, 1);
+    }
+
+    lua_settop(L, 4);
+}
+
+/* Loads a binary dumpfile from a string or mapped file. Returns true. */
+static int loadbinarydump_cb(lua_State* L)
+{
+    size_t len;
+    const char* data = checkdata(L, 1, &len);
+    luaL_checktype(L, 2, LUA_TTABLE);    /* documentset */
+    luaL_checktype(L, 3, LUA_TFUNCTION); /* CreateDocument */
+    luaL_checktype(L, 4, LUA_TTABLE);    /* Paragraph */
+    lua_settop(L, 4);
+
+    if (!isbinarydumpfile(data, len))
+        luaL_error(L, "not a binary dumpfile");
+    loadbinary(L, data, len);
+    lua_pushboolean(L, true);
+    return 1;
+}
+
+static int pusherrno(lua_State* L)
+{
+    lua_pushnil(L);
+    lua_pushstring(L, strerror(errno));
+    lua_pushinteger(L, errno);
+    return 3;
+}
+
+/* Writes a binary dumpfile. metadata is the property lines of the
+ * documentset, and documents its array of documents. Returns true, or nil
+ * and an error. */
+static int writebinarydumpfile_cb(lua_State* L)
+{
+    const char* filename = luaL_checklstring(L, 1, nullptr);
+    size_t metadatasize;
+    const char* metadata = luaL_checklstring(L, 2, &metadatasize);
+    luaL_checktype(L, 3, LUA_TTABLE); /* documents */
+    lua_settop(L, 3);
+
+    /* Encode the paragraphs, collecting the strings as we go. The strings
+     * belong to the documents, which outlive this function. */
+
+    std::unordered_map<std::string_view, uint32_t> stringnumbers;
+    std::vector<std::string_view> strings;
+    auto stringnumber = [&](int index)
+    {
+        if (lua_type(L, index) != LUA_TSTRING)
+            luaL_error(L, "paragraph contains a non-string");
+        size_t len;
+        const char* s = lua_tolstring(L, index, &len);
+        auto [it, inserted] =
+            stringnumbers.try_emplace(std::string_view(s, len), strings.size());
+        if (inserted)
+            strings.push_back(it->first);
+        return it->second;
+    };
+
+    int documentcount = lua_rawlen(L, 3);
+    std::vector<std::string> paragraphs(documentcount);
+    std::vector<uint32_t> paragraphcounts(documentcount);
+    for (int dn = 0; dn < documentcount; dn++)
+    {
+        lua_rawgeti(L, 3, dn + 1);
+        luaL_checktype(L, -1, LUA_TTABLE);
+        int count = lua_rawlen(L, -1);
+        paragraphcounts[dn] = count;
+        std::string& encoded = paragraphs[dn];
+        for (int pn = 1; pn <= count; pn++)
+        {
+            lua_rawgeti(L, -1, pn);
+            luaL_checktype(L, -1, LUA_TTABLE);
+            lua_getfield(L, -1, "style");
+            appendu32(encoded, stringnumber(-1));
+            lua_pop(L, 1);
+
+            int words = lua_rawlen(L, -1);
+            appendu32(encoded, words);
+            for (int wn = 1; wn <= words; wn++)
+            {
+                lua_rawgeti(L, -1, wn);
+                appendu32(encoded, stringnumber(-1));
+                lua_pop(L, 1);
+            }
+            lua_pop(L, 1);
+        }
+        lua_pop(L, 1);
+    }
+
+    /* Lay out the file. */
+
+    std::string header(BMAGIC, sizeof(BMAGIC) - 1);
+    appendu32(header, metadatasize);
+    appendu32(header, strings.size());
+    appendu32(header, documentcount);
+
+    std::string stringtable;
+    size_t stringssize = 0;
+    for (std::string_view s : strings)
+    {
+        appendu32(stringtable, stringssize);
+        stringssize += s.size();
+    }
+    appendu32(stringtable, stringssize);
+
+    uint64_t offset = header.size() + (uint64_t)documentcount * 8 +
+                      metadatasize + stringtable.size() + stringssize;
+    for (int dn = 0; dn < documentcount; dn++)
+    {
+        appendu32(header, offset);
+        appendu32(header, paragraphcounts[dn]);
+        offset += paragraphs[dn].size();
+    }
+    if (offset > UINT32_MAX)
+        luaL_error(L, "document set is too big for a binary dumpfile");
+
+    FILE* fp = fopen(filename, "wb");
+    if (!fp)
+        return pusherrno(L);
+
+    fwrite(header.data(), 1, header.size(), fp);
+    fwrite(metadata, 1, metadatasize, fp);
+    fwrite(stringtable.data(), 1, stringtable.size(), fp);
+    for (std::string_view s : strings)
+        fwrite(s.data(), 1, s.size(), fp);
+    for (const std::string& s : paragraphs)
+        fwrite(s.data(), 1, s.size(), fp);
+
+    if (ferror(fp))
+    {
+        pusherrno(L);
+        fclose(fp);
+        return 3;
+    }
+    if (fclose(fp) != 0)
+        return pusherrno(L);
+
+    lua_pushboolean(L, true);
+    return 1;
+}
+
+void dumpfile_init(void)
+{
+    const static luaL_Reg funcs[] = {
+        {"loadbinarydump",      loadbinarydump_cb     },
+        {"loadtextdumpfile",    loadtextdumpfile_cb   },
+        {"loadtextparagraphs",  loadtextparagraphs_cb },
+        {"writebinarydumpfile", writebinarydumpfile_cb},
+        {NULL,                  NULL                  }
+    };
+
+    lua_getglobal(L, "wg");
+    luaL_register(L, NULL, funcs);
+}
+
+// vim: sw=4 ts=4 et
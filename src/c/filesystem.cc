@@ -10,10 +10,53 @@
 #include <string.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <algorithm>
+#if !defined WIN32
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#endif
 #include <string>
 #include <filesystem>
 #include <iostream>
 
+#if !defined O_BINARY
+#define O_BINARY 0
+#endif
+
+/* Maximum number of buffers passed to each writev(). */
+#if defined IOV_MAX && (IOV_MAX < 256)
+#define WRITEBATCH IOV_MAX
+#else
+#define WRITEBATCH 256
+#endif
+
+#if defined WIN32
+/* Windows has no writev(), so it's done one buffer at a time. */
+struct iovec
+{
+    void* iov_base;
+    size_t iov_len;
+};
+
+static ssize_t writev(int fd, const struct iovec* iov, int count)
+{
+    ssize_t total = 0;
+    for (int i = 0; i < count; i++)
+    {
+        ssize_t w = write(fd, iov[i].iov_base, iov[i].iov_len);
+        if (w < 0)
+            return total ? total : w;
+        total += w;
+        if ((size_t)w != iov[i].iov_len)
+            break;
+    }
+    return total;
+}
+#endif
+
 static int pusherrno(lua_State* L)
 {
     lua_pushnil(L);
@@ -205,6 +248,58 @@ static int printout_cb(lua_State* L)
     return 0;
 }
 
+/* Forks the process, returning the child's pid in the parent and 0 in the
+ * child. The child shares the terminal with the parent, so it mustn't draw
+ * anything, and must leave with wg.exitchild(). */
+static int fork_cb(lua_State* L)
+{
+#if defined WIN32
+    errno = ENOSYS;
+    return pusherrno(L);
+#else
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid == -1)
+        return pusherrno(L);
+
+    lua_pushinteger(L, pid);
+    return 1;
+#endif
+}
+
+/* Returns false if the child process is still running, or its exit status if
+ * it's finished (and it's then gone). */
+static int waitpid_cb(lua_State* L)
+{
+#if defined WIN32
+    errno = ENOSYS;
+    return pusherrno(L);
+#else
+    pid_t pid = forceinteger(L, 1);
+    int status;
+    pid_t r = waitpid(pid, &status, WNOHANG);
+    if (r == -1)
+        return pusherrno(L);
+
+    if (r == 0)
+        lua_pushboolean(L, false);
+    else if (WIFSIGNALED(status))
+        lua_pushinteger(L, 128 + WTERMSIG(status));
+    else
+        lua_pushinteger(L, WEXITSTATUS(status));
+    return 1;
+#endif
+}
+
+/* Exits a child process made by wg.fork() without running any of the
+ * parent's exit handlers, which would reset the terminal. */
+static int exitchild_cb(lua_State* L)
+{
+    int e = forceinteger(L, 1);
+    _exit(e);
+}
+
 static int mkdtemp_cb(lua_State* L)
 {
     std::string path = std::filesystem::temp_directory_path().string();
@@ -220,79 +315,450 @@ static int mkdtemp_cb(lua_State* L)
         return pusherrno(L);
 }
 
+/* Regular files are read in one go into a string of exactly the right size,
+ * so that there's only one allocation and no copying. */
 static int readfile_cb(lua_State* L)
 {
     const char* filename = luaL_checklstring(L, 1, nullptr);
 
     FILE* fp = fopen(filename, "rb");
     if (!fp)
-        goto error;
+        return pusherrno(L);
 
     luaL_Buffer buffer;
-    luaL_buffinit(L, &buffer);
+    struct stat st;
+    if ((fstat(fileno(fp), &st) == 0) && S_ISREG(st.st_mode) && st.st_size)
+    {
+        char* p = luaL_buffinitsize(L, &buffer, st.st_size);
+        buffer.p += fread(p, 1, st.st_size, fp);
+    }
+    else
+        luaL_buffinit(L, &buffer);
 
+    /* Anything else (or anything added to the file since the stat) is read
+     * a piece at a time. */
     for (;;)
     {
         char b[LUA_BUFFERSIZE];
         size_t i = fread(b, 1, LUA_BUFFERSIZE, fp);
         if (i == 0)
             break;
-        if (i < 0)
-            goto error;
 
         luaL_addlstring(&buffer, b, i);
     }
 
+    if (ferror(fp))
+    {
+        pusherrno(L);
+        fclose(fp);
+        return 3;
+    }
+
     fclose(fp);
     luaL_pushresult(&buffer);
     return 1;
+}
 
-error:
-    pusherrno(L);
-    if (fp)
-        fclose(fp);
-    return 3;
+/* Mapped files are read-only views of a file's contents, which the native
+ * loaders accept anywhere they accept a string (see checkdata()), so that
+ * big files never have to be copied into memory. They behave enough like
+ * strings for Lua to use # and sub() on them. The file mustn't be
+ * truncated while it's mapped; WordGrinder always saves to a new file and
+ * renames it over the old one, so this only happens if something else
+ * changes it. */
+
+#define MAPPEDFILE "wg.mappedfile"
+
+struct MappedFile
+{
+    const char* data;
+    size_t len;
+};
+
+static void mappedfile_dtor(void* p)
+{
+#if !defined WIN32
+    MappedFile* mf = (MappedFile*)p;
+    if (mf->len)
+        munmap((void*)mf->data, mf->len);
+#endif
 }
 
-static int writefile_cb(lua_State* L)
+const char* checkdata(lua_State* L, int index, size_t* len)
+{
+    if (lua_type(L, index) == LUA_TSTRING)
+        return lua_tolstring(L, index, len);
+
+    MappedFile* mf = (MappedFile*)luaL_checkudata(L, index, MAPPEDFILE);
+    *len = mf->len;
+    return mf->data;
+}
+
+static int mapfile_cb(lua_State* L)
 {
     const char* filename = luaL_checklstring(L, 1, nullptr);
+
+#if defined WIN32
+    errno = ENOSYS;
+    return pusherrno(L);
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+        return pusherrno(L);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        pusherrno(L);
+        close(fd);
+        return 3;
+    }
+    if (!S_ISREG(st.st_mode))
+    {
+        close(fd);
+        errno = ENODEV;
+        return pusherrno(L);
+    }
+
+    void* data = nullptr;
+    if (st.st_size)
+    {
+        data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            pusherrno(L);
+            close(fd);
+            return 3;
+        }
+    }
+    close(fd);
+
+    MappedFile* mf = (MappedFile*)lua_newuserdatadtor(
+        L, sizeof(MappedFile), mappedfile_dtor);
+    mf->data = (const char*)data;
+    mf->len = st.st_size;
+    luaL_getmetatable(L, MAPPEDFILE);
+    lua_setmetatable(L, -2);
+    return 1;
+#endif
+}
+
+static int mappedfile_len_cb(lua_State* L)
+{
     size_t len;
-    const char* data = luaL_checklstring(L, 2, &len);
+    checkdata(L, 1, &len);
+    lua_pushnumber(L, len);
+    return 1;
+}
 
-    FILE* fp = fopen(filename, "wb");
-    if (!fp)
-        goto error;
+/* As string.sub(). */
+static int mappedfile_sub_cb(lua_State* L)
+{
+    size_t len;
+    const char* data = checkdata(L, 1, &len);
+    double i = luaL_optnumber(L, 2, 1);
+    double j = luaL_optnumber(L, 3, -1);
+
+    if (i < 0)
+        i = std::max<double>(len + i + 1, 1);
+    else if (i == 0)
+        i = 1;
+    if (j < 0)
+        j = len + j + 1;
+    else if (j > len)
+        j = len;
+
+    if (i > j)
+        lua_pushliteral(L, "");
+    else
+        lua_pushlstring(L, data + (size_t)i - 1, (size_t)(j - i) + 1);
+    return 1;
+}
 
-    while (len != 0)
+/* Writes out an array of buffers, coping with short writes. */
+static bool writeiov(int fd, struct iovec* iov, int count)
+{
+    while (count)
     {
-        size_t i = fwrite(data, 1, len, fp);
+        ssize_t i = writev(fd, iov, count);
         if (i < 0)
-            goto error;
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+
+        while (count && ((size_t)i >= iov->iov_len))
+        {
+            i -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count)
+        {
+            iov->iov_base = (char*)iov->iov_base + i;
+            iov->iov_len -= i;
+        }
+    }
+    return true;
+}
 
-        len -= i;
-        data += i;
+/* The data may be a string or an array of strings, which are written one
+ * after the other; this saves callers from having to concatenate them
+ * first. They're handed to the kernel WRITEBATCH at a time. */
+static int writefile_cb(lua_State* L)
+{
+    const char* filename = luaL_checklstring(L, 1, nullptr);
+    int data = 2;
+    int count = 1;
+    if (lua_type(L, 2) == LUA_TTABLE)
+    {
+        count = lua_objlen(L, 2);
+        bool numbers = false;
+        for (int i = 1; i <= count; i++)
+        {
+            lua_rawgeti(L, 2, i);
+            if (lua_type(L, -1) == LUA_TNUMBER)
+                numbers = true;
+            else if (lua_type(L, -1) != LUA_TSTRING)
+                luaL_error(L, "fragment %d of the data is not a string", i);
+            lua_pop(L, 1);
+        }
+
+        /* As table.concat(), numbers are allowed. They're converted into a
+         * copy of the table, which keeps the strings alive, so that the
+         * caller's table is left alone. */
+        if (numbers)
+        {
+            lua_createtable(L, count, 0);
+            for (int i = 1; i <= count; i++)
+            {
+                lua_rawgeti(L, 2, i);
+                lua_tolstring(L, -1, nullptr);
+                lua_rawseti(L, -2, i);
+            }
+            data = lua_gettop(L);
+        }
     }
-    fclose(fp);
-    return 0;
+    else
+        luaL_checklstring(L, 2, nullptr);
+
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666);
+    if (fd == -1)
+        return pusherrno(L);
+
+    /* The table keeps the strings alive after they're popped. */
+    struct iovec iov[WRITEBATCH];
+    int n = 0;
+    for (int i = 1; i <= count; i++)
+    {
+        size_t len;
+        const char* s;
+        if (lua_type(L, data) == LUA_TTABLE)
+        {
+            lua_rawgeti(L, data, i);
+            s = lua_tolstring(L, -1, &len);
+            lua_pop(L, 1);
+        }
+        else
+            s = lua_tolstring(L, data, &len);
+
+        if (!len)
+            continue;
+        iov[n].iov_base = (void*)s;
+        iov[n].iov_len = len;
+        n++;
+
+        if (n == WRITEBATCH)
+        {
+            if (!writeiov(fd, iov, n))
+                goto error;
+            n = 0;
+        }
+    }
+    if (n && !writeiov(fd, iov, n))
+        goto error;
+
+    if (close(fd) != 0)
+        return pusherrno(L);
+    lua_pushboolean(L, true);
+    return 1;
 
 error:
     pusherrno(L);
-    if (fp)
-        fclose(fp);
+    close(fd);
     return 3;
 }
 
+/* Buffered file handles, so that large files can be written a piece at a time
+ * rather than having to be assembled into a string first. Errors are sticky:
+ * once a write has failed all later operations fail with the same error,
+ * so callers need only check the result of close(). */
+
+#define FILEHANDLE "wg.filehandle"
+#define FILEBUFFERSIZE (256 * 1024)
+
+struct FileHandle
+{
+    FILE* fp;
+    int error;
+    int pid; /* of the process which opened it */
+};
+
+static void setfileerror(FileHandle* fh)
+{
+    if (!fh->error)
+        fh->error = errno ? errno : EIO;
+}
+
+static int pushfileerror(lua_State* L, FileHandle* fh)
+{
+    errno = fh->error;
+    return pusherrno(L);
+}
+
+static FileHandle* checkfile(lua_State* L)
+{
+    FileHandle* fh = (FileHandle*)luaL_checkudata(L, 1, FILEHANDLE);
+    if (!fh->fp)
+        luaL_error(L, "file is closed");
+    return fh;
+}
+
+/* A child made by wg.fork() inherits the parent's handles along with
+ * whatever's in their buffers, so it mustn't close them (which would write
+ * the buffers out a second time); only the process which opened a handle
+ * does. */
+static void filehandle_dtor(void* p)
+{
+    FileHandle* fh = (FileHandle*)p;
+    if (fh->fp && (fh->pid == getpid()))
+        fclose(fh->fp);
+}
+
+static int openfile_cb(lua_State* L)
+{
+    const char* filename = luaL_checklstring(L, 1, nullptr);
+    std::string mode = luaL_optlstring(L, 2, "w", nullptr);
+    if ((mode != "w") && (mode != "a"))
+        luaL_argerror(L, 2, "mode must be 'w' or 'a'");
+    mode += "b";
+
+    FILE* fp = fopen(filename, mode.c_str());
+    if (!fp)
+        return pusherrno(L);
+    setvbuf(fp, nullptr, _IOFBF, FILEBUFFERSIZE);
+
+    FileHandle* fh =
+        (FileHandle*)lua_newuserdatadtor(L, sizeof(FileHandle), filehandle_dtor);
+    fh->fp = fp;
+    fh->error = 0;
+    fh->pid = getpid();
+    luaL_getmetatable(L, FILEHANDLE);
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
+static int file_write_cb(lua_State* L)
+{
+    FileHandle* fh = checkfile(L);
+
+    int count = lua_gettop(L);
+    for (int i = 2; i <= count; i++)
+    {
+        size_t len;
+        const char* data = luaL_checklstring(L, i, &len);
+        if (!fh->error && (fwrite(data, 1, len, fh->fp) != len))
+            setfileerror(fh);
+    }
+
+    if (fh->error)
+        return pushfileerror(L, fh);
+    lua_pushboolean(L, true);
+    return 1;
+}
+
+static int file_flush_cb(lua_State* L)
+{
+    FileHandle* fh = checkfile(L);
+    if (!fh->error && (fflush(fh->fp) != 0))
+        setfileerror(fh);
+
+    if (fh->error)
+        return pushfileerror(L, fh);
+    lua_pushboolean(L, true);
+    return 1;
+}
+
+/* Flushes the file and waits for it to reach the disk. */
+static int file_sync_cb(lua_State* L)
+{
+    FileHandle* fh = checkfile(L);
+    if (!fh->error && (fflush(fh->fp) != 0))
+        setfileerror(fh);
+    if (!fh->error && (fsync(fileno(fh->fp)) != 0))
+        setfileerror(fh);
+
+    if (fh->error)
+        return pushfileerror(L, fh);
+    lua_pushboolean(L, true);
+    return 1;
+}
+
+static int file_close_cb(lua_State* L)
+{
+    FileHandle* fh = checkfile(L);
+    if (fclose(fh->fp) != 0)
+        setfileerror(fh);
+    fh->fp = nullptr;
+
+    if (fh->error)
+        return pushfileerror(L, fh);
+    lua_pushboolean(L, true);
+    return 1;
+}
+
 void filesystem_init(void)
 {
+    const static luaL_Reg filemethods[] = {
+        {"close", file_close_cb},
+        {"flush", file_flush_cb},
+        {"sync",  file_sync_cb },
+        {"write", file_write_cb},
+        {NULL,    NULL         }
+    };
+
+    luaL_newmetatable(L, FILEHANDLE);
+    lua_newtable(L);
+    luaL_register(L, nullptr, filemethods);
+    lua_setfield(L, -2, "__index");
+    lua_pop(L, 1);
+
+    const static luaL_Reg mappedfilemethods[] = {
+        {"sub", mappedfile_sub_cb},
+        {NULL,  NULL             }
+    };
+
+    luaL_newmetatable(L, MAPPEDFILE);
+    lua_newtable(L);
+    luaL_register(L, nullptr, mappedfilemethods);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, mappedfile_len_cb);
+    lua_setfield(L, -2, "__len");
+    lua_pop(L, 1);
+
     const static luaL_Reg funcs[] = {
         {"access",    access_cb   },
         {"chdir",     chdir_cb    },
+        {"exitchild", exitchild_cb},
+        {"fork",      fork_cb     },
         {"getcwd",    getcwd_cb   },
         {"getenv",    getenv_cb   },
+        {"mapfile",   mapfile_cb  },
         {"mkdir",     mkdir_cb    },
         {"mkdirs",    mkdirs_cb    },
         {"mkdtemp",   mkdtemp_cb  },
+        {"openfile",  openfile_cb },
         {"printerr",  printerr_cb },
         {"printout",  printout_cb },
         {"readdir",   readdir_cb  },
@@ -300,6 +766,7 @@ void filesystem_init(void)
         {"remove",    remove_cb   },
         {"rename",    rename_cb   },
         {"stat",      stat_cb     },
+        {"waitpid",   waitpid_cb  },
         {"writefile", writefile_cb},
         {NULL,        NULL        }
     };
@@ -79,6 +79,8 @@ extern int main(int argc, char* argv[]);
 #endif
 
 extern lua_State* L;
+int luaL_loadbytecode(
+    lua_State* L, const char* data, size_t len, const char* name);
 int luaL_loadstring(lua_State* L, const char* str, const char* name);
 int luaL_dostring(lua_State* L, const char* str, const char* name);
 
@@ -117,6 +119,7 @@ extern void bit32_init(lua_State* L);
 extern void screen_init(const char* argv[]);
 extern void screen_deinit(void);
 extern void dpy_writeunichar(int x, int y, uni_t c);
+extern int getstringwidth(const char* s, size_t size);
 extern void decode_mouse_event(uni_t key, int* x, int* y, bool* p);
 extern uni_t encode_mouse_event(int x, int y, bool p);
 
@@ -128,6 +131,10 @@ extern void word_init(void);
 
 extern void zip_init(void);
 
+/* --- Dumpfiles --------------------------------------------------------- */
+
+extern void dumpfile_init(void);
+
 /* --- CommonMark -------------------------------------------------------- */
 
 extern void cmark_init(void);
@@ -137,6 +144,10 @@ extern void cmark_init(void);
 extern int getu8bytes(char c);
 extern uni_t readu8(const char** ptr);
 extern void writeu8(char** ptr, uni_t value);
+extern std::string unescapestring(const char* data, size_t len);
+
+/* Returns the contents of a string or mapped file (see wg.mapfile()). */
+extern const char* checkdata(lua_State* L, int index, size_t* len);
 
 extern void utils_init(void);
 extern void filesystem_init(void);
@@ -187,6 +198,7 @@ extern void dpy_shutdown(void);
 extern void dpy_setattr(int andmask, int ormask);
 extern void dpy_setcolour(const colour_t* fg, const colour_t* bg);
 extern void dpy_writechar(int x, int y, uni_t c);
+extern int dpy_writestring(int x, int y, const char* s, size_t size);
 extern void dpy_setcursor(int x, int y, bool shown);
 extern void dpy_clearscreen(void);
 extern void dpy_sync(void);
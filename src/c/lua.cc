@@ -6,7 +6,8 @@
 #include "globals.h"
 #include <fstream>
 #include <string>
-#include "Luau/Compiler.h"
+#include "luauoptions.h"
+#include "Luau/Bytecode.h"
 
 #include "lua.h"
 #include "lualib.h"
@@ -24,20 +25,17 @@
 
 lua_State* L;
 
-static Luau::CompileOptions copts()
+int luaL_loadbytecode(
+    lua_State* L, const char* data, size_t len, const char* name)
 {
-    Luau::CompileOptions result = {};
-    result.optimizationLevel = 2;
-    result.debugLevel = 1;
-    result.coverageLevel = 0;
-    return result;
-}
+    lua_setsafeenv(L, LUA_ENVIRONINDEX, false);
 
-static Luau::ParseOptions popts()
-{
-    Luau::ParseOptions result = {};
-    result.allowDeclarationSyntax = true;
-    return result;
+    if (luau_load(L, name ? name : "(anonymous)", data, len, 0) == 0)
+        return 0;
+
+    lua_pushnil(L);
+    lua_insert(L, -2); /* put before error message */
+    return LUA_ERRRUN;
 }
 
 int luaL_loadstring(lua_State* L, const char* str, const char* name)
@@ -140,6 +138,41 @@ static int loadstring_cb(lua_State* L)
     return 2;
 }
 
+/* Compiles source to bytecode without loading it, so that the result can be
+ * cached (see LoadStringWithCache in main.lua). */
+
+static int compile_cb(lua_State* L)
+{
+    size_t len;
+    const char* s = luaL_checklstring(L, 1, &len);
+    const char* name = luaL_optlstring(L, 2, "(anonymous)", nullptr);
+
+    std::string bytecode =
+        Luau::compile(std::string(s, len), copts(), popts());
+    if (bytecode.empty() || (bytecode[0] == 0))
+    {
+        /* The error message follows the zero byte. */
+        lua_pushnil(L);
+        lua_pushfstring(
+            L, "%s%s", name, bytecode.empty() ? "" : bytecode.c_str() + 1);
+        return 2;
+    }
+
+    lua_pushlstring(L, bytecode.data(), bytecode.size());
+    return 1;
+}
+
+static int loadbytecode_cb(lua_State* L)
+{
+    size_t len;
+    const char* s = luaL_checklstring(L, 1, &len);
+    const char* name = luaL_optlstring(L, 2, nullptr, nullptr);
+
+    if (luaL_loadbytecode(L, s, len, name) == 0)
+        return 1;
+    return 2;
+}
+
 static int exit_cb(lua_State* L)
 {
     int e = forceinteger(L, 1);
@@ -176,10 +209,17 @@ void script_init(void)
     luaL_register(L,
         "wg",
         (const luaL_Reg[]){
-            {"exit", exit_cb},
+            {"compile",      compile_cb     },
+            {"exit",         exit_cb        },
+            {"loadbytecode", loadbytecode_cb},
             {}
     });
 
+    const static luaL_Constant consts[] = {
+        {"BYTECODEVERSION", LBC_VERSION_TARGET},
+    };
+    luaL_setconstants(L, consts, sizeof(consts) / sizeof(*consts));
+
     lua_pushboolean(L,
 #ifndef NDEBUG
         1
@@ -194,7 +234,15 @@ void script_load_from_table(const FileDescriptor* table)
 {
     while (table->name)
     {
+#if EMBEDDED_BYTECODE
+        /* The scripts were compiled at build time; see multibin2c.sh. */
+        int status = luaL_loadbytecode(
+            L, table->data.data(), table->data.size(), table->name);
+        if (status == 0)
+            status = lua_pcall(L, 0, LUA_MULTRET, 0);
+#else
         int status = luaL_dostring(L, table->data.c_str(), table->name);
+#endif
         if (status)
         {
             (void)report(L, status);
@@ -0,0 +1,31 @@
+/* © 2025 David Given.
+ * WordGrinder is licensed under the MIT open source license. See the COPYING
+ * file in this distribution for the full text.
+ */
+
+#ifndef LUAUOPTIONS_H
+#define LUAUOPTIONS_H
+
+#include "Luau/Compiler.h"
+
+/* These are shared between the runtime compiler in lua.cc and the build-time
+ * precompiler in tools/luaucompile.cc, so that precompiled bytecode is
+ * identical to what the runtime would have produced. */
+
+static inline Luau::CompileOptions copts()
+{
+    Luau::CompileOptions result = {};
+    result.optimizationLevel = 2;
+    result.debugLevel = 1;
+    result.coverageLevel = 0;
+    return result;
+}
+
+static inline Luau::ParseOptions popts()
+{
+    Luau::ParseOptions result = {};
+    result.allowDeclarationSyntax = true;
+    return result;
+}
+
+#endif
@@ -19,6 +19,7 @@ int main(int argc, char* argv[])
     utils_init();
     filesystem_init();
     zip_init();
+    dumpfile_init();
     clipboard_init();
     cmark_init();
 
@@ -9,6 +9,7 @@
 #include <wctype.h>
 #include <sys/time.h>
 #include <time.h>
+#include <algorithm>
 
 #define KEY_TIMEOUT (KEY_MAX + 1)
 #define FIRST_COLOUR_ID 1
@@ -32,6 +33,89 @@ typedef struct
 static std::vector<colour_t> colours;
 static std::vector<pair_t> colourPairs;
 
+/* Everything is drawn into a shadow buffer of cells rather than straight
+ * into ncurses. dpy_sync() compares it with what ncurses was last given and
+ * only passes on the cells which have changed, so the Lua code can repaint
+ * the whole screen on every redraw and only pay for what's different. */
+
+typedef struct
+{
+    uni_t c;         /* 0 for the right half of a double-width character */
+    uni_t combining; /* zero-width character drawn on top of c, or 0 */
+    uint8_t attr;    /* DPY_* flags */
+    short pair;
+} cell_t;
+
+static bool operator==(const cell_t& a, const cell_t& b)
+{
+    return (a.c == b.c) && (a.combining == b.combining) &&
+           (a.attr == b.attr) && (a.pair == b.pair);
+}
+
+static int screenWidth = 0;
+static int screenHeight = 0;
+static std::vector<cell_t> backBuffer;  /* what's been drawn */
+static std::vector<cell_t> frontBuffer; /* what ncurses has been given */
+static int cursorX = 0;
+static int cursorY = 0;
+
+/* For the tests, which have no terminal: the buffers are drawn into as
+ * usual, but wg.sync() returns the runs which would have been sent to
+ * ncurses instead of sending them. */
+static bool fake = false;
+
+/* Makes the buffers match the size of the screen. The front buffer is
+ * filled with cells which can't match anything, so everything is sent to
+ * ncurses on the next sync. */
+static void resize_buffers(bool force)
+{
+    int w = 0;
+    int h = 0;
+    if (fake)
+    {
+        w = screenWidth;
+        h = screenHeight;
+    }
+    else if (stdscr)
+        getmaxyx(stdscr, h, w);
+    if (!force && (w == screenWidth) && (h == screenHeight))
+        return;
+
+    screenWidth = w;
+    screenHeight = h;
+    backBuffer.assign(w * h, cell_t{' ', 0, 0, 0});
+    frontBuffer.assign(w * h, cell_t{-1, 0, 0, 0});
+}
+
+static cell_t* getcell(int x, int y)
+{
+    if ((x < 0) || (y < 0) || (x >= screenWidth) || (y >= screenHeight))
+        return NULL;
+    return &backBuffer[y * screenWidth + x];
+}
+
+/* When the left half of a double-width character is about to be
+ * overwritten, or the right half has been, the other half is replaced with a
+ * space (as the terminal would). These are called on the cells at either end
+ * of whatever's been overwritten. */
+static void break_left(int x, int y)
+{
+    cell_t* cell = getcell(x, y);
+    if (cell && (cell->c == 0))
+    {
+        cell = getcell(x - 1, y);
+        cell->c = ' ';
+        cell->combining = 0;
+    }
+}
+
+static void break_right(int x, int y)
+{
+    cell_t* cell = getcell(x, y);
+    if (cell && (cell->c == 0))
+        cell->c = ' ';
+}
+
 void dpy_init(const char* argv[])
 {
     // ESCDELAY defaults to 1000 (ms) in ncurses. This is why the menu requires a 1 second delay to appear after hitting escape.
@@ -52,6 +136,7 @@ void dpy_init(const char* argv[])
 void dpy_start(void)
 {
     initscr();
+    resize_buffers(true);
 
     use_colours = enable_colours && has_colors() && can_change_color();
     if (use_colours)
@@ -84,14 +169,15 @@ void dpy_shutdown(void)
 
 void dpy_clearscreen(void)
 {
-    int w, h;
-    getmaxyx(stdscr, h, w);
-    dpy_cleararea(0, 0, w - 1, h - 1);
+    resize_buffers(false);
+    dpy_cleararea(0, 0, screenWidth - 1, screenHeight - 1);
 }
 
 void dpy_getscreensize(int* x, int* y)
 {
-    getmaxyx(stdscr, *y, *x);
+    resize_buffers(false);
+    *x = screenWidth;
+    *y = screenHeight;
 }
 
 void dpy_getmouse(uni_t key, int* x, int* y, bool* p)
@@ -100,20 +186,10 @@ void dpy_getmouse(uni_t key, int* x, int* y, bool* p)
     *p = false;
 }
 
-void dpy_sync(void)
-{
-    refresh();
-}
-
-void dpy_setcursor(int x, int y, bool shown)
-{
-    move(y, x);
-}
-
-static void update_attrs()
+static attr_t get_curses_attrs(int attr)
 {
     attr_t cattr = 0;
-    if (currentAttr & DPY_ITALIC)
+    if (attr & DPY_ITALIC)
     {
 #if defined WA_ITALIC
         if (use_italics)
@@ -124,29 +200,105 @@ static void update_attrs()
         cattr |= WA_BOLD;
 #endif
     }
-    if (currentAttr & DPY_BOLD)
+    if (attr & DPY_BOLD)
         cattr |= WA_BOLD;
-    if (!use_colours && (currentAttr & DPY_BRIGHT))
+    if (!use_colours && (attr & DPY_BRIGHT))
         cattr |= WA_BOLD;
-    if (!use_colours && (currentAttr & DPY_DIM))
+    if (!use_colours && (attr & DPY_DIM))
         cattr |= WA_DIM;
-    if (currentAttr & DPY_UNDERLINE)
+    if (attr & DPY_UNDERLINE)
         cattr |= WA_UNDERLINE;
-    if (currentAttr & DPY_REVERSE)
+    if (attr & DPY_REVERSE)
         cattr |= WA_REVERSE;
+    return cattr;
+}
 
-    if (use_colours)
-        attr_set(cattr, currentPair, NULL);
-    else
-        attr_set(cattr, 0, NULL);
+/* Sends every changed cell to ncurses, a run of cells with the same
+ * attributes at a time. If L is given, the runs are appended to the table on
+ * the top of its stack instead. */
+static void flush_buffers(lua_State* L)
+{
+    std::string run;
+    for (int y = 0; y < screenHeight; y++)
+    {
+        cell_t* back = &backBuffer[y * screenWidth];
+        cell_t* front = &frontBuffer[y * screenWidth];
+        int x = 0;
+        while (x < screenWidth)
+        {
+            /* The right half of a double-width character is drawn along
+             * with the left. */
+            if ((back[x] == front[x]) || (back[x].c == 0))
+            {
+                front[x] = back[x];
+                x++;
+                continue;
+            }
+
+            int startx = x;
+            int attr = back[x].attr;
+            short pair = back[x].pair;
+            run.clear();
+            while ((x < screenWidth) && !(back[x] == front[x]))
+            {
+                const cell_t& cell = back[x];
+                if (cell.c != 0)
+                {
+                    if ((cell.attr != attr) || (cell.pair != pair))
+                        break;
+
+                    char buffer[16];
+                    char* p = buffer;
+                    writeu8(&p, cell.c);
+                    if (cell.combining)
+                        writeu8(&p, cell.combining);
+                    run.append(buffer, p - buffer);
+                }
+                front[x] = cell;
+                x++;
+            }
+
+            if (L)
+            {
+                lua_createtable(L, 0, 5);
+                lua_pushnumber(L, startx);
+                lua_setfield(L, -2, "x");
+                lua_pushnumber(L, y);
+                lua_setfield(L, -2, "y");
+                lua_pushnumber(L, attr);
+                lua_setfield(L, -2, "attr");
+                lua_pushnumber(L, pair);
+                lua_setfield(L, -2, "pair");
+                lua_pushlstring(L, run.data(), run.size());
+                lua_setfield(L, -2, "text");
+                lua_rawseti(L, -2, lua_objlen(L, -2) + 1);
+                continue;
+            }
+
+            attr_set(get_curses_attrs(attr), use_colours ? pair : 0, NULL);
+            mvaddnstr(y, startx, run.data(), run.size());
+        }
+    }
+}
+
+void dpy_sync(void)
+{
+    resize_buffers(false);
+    flush_buffers(NULL);
+    move(cursorY, cursorX);
+    refresh();
+}
+
+void dpy_setcursor(int x, int y, bool shown)
+{
+    cursorX = x;
+    cursorY = y;
 }
 
 void dpy_setattr(int andmask, int ormask)
 {
     currentAttr &= andmask;
     currentAttr |= ormask;
-
-    update_attrs();
 }
 
 static uint8_t lookup_colour(const colour_t* colour)
@@ -160,7 +312,8 @@ static uint8_t lookup_colour(const colour_t* colour)
 
     uint8_t id = colours.size() + FIRST_COLOUR_ID;
     colours.emplace_back(*colour);
-    init_color(id, colour->r * 1000.0, colour->g * 1000.0, colour->b * 1000.0);
+    if (!fake)
+        init_color(id, colour->r * 1000.0, colour->g * 1000.0, colour->b * 1000.0);
     return id;
 }
 
@@ -178,7 +331,6 @@ void dpy_setcolour(const colour_t* fg, const colour_t* bg)
         if ((p->fg == fgc) && (p->bg == bgc))
         {
             currentPair = FIRST_PAIR_ID + i;
-            update_attrs();
             return;
         }
     }
@@ -186,27 +338,92 @@ void dpy_setcolour(const colour_t* fg, const colour_t* bg)
     currentPair = colourPairs.size() + FIRST_PAIR_ID;
     colourPairs.emplace_back(pair_t{fgc, bgc});
 
-    init_pair(currentPair, fgc, bgc);
-    update_attrs();
+    if (!fake)
+        init_pair(currentPair, fgc, bgc);
+}
+
+/* Writes a character into the back buffer, returning the x coordinate of
+ * the next one. The callers deal with any double-width characters which
+ * have been partly overwritten. */
+static int put_char(int x, int y, uni_t c, int width)
+{
+    if ((c == 0) || (width < 0))
+        return x;
+
+    if (width == 0)
+    {
+        /* As ncurses, zero-width characters go on top of the previous
+         * character. */
+        cell_t* cell = getcell(x - 1, y);
+        if (cell && (cell->c == 0))
+            cell = getcell(x - 2, y);
+        if (cell)
+            cell->combining = c;
+        return x;
+    }
+
+    cell_t* cell = getcell(x, y);
+    if (!cell)
+        return x + width;
+    cell_t* right = (width == 2) ? getcell(x + 1, y) : NULL;
+    if ((width == 2) && !right)
+        c = ' '; /* doesn't fit */
+
+    *cell = cell_t{c, 0, (uint8_t)currentAttr, currentPair};
+    if (right)
+        *right = cell_t{0, 0, (uint8_t)currentAttr, currentPair};
+    return x + width;
 }
 
 void dpy_writechar(int x, int y, uni_t c)
 {
-    char buffer[8];
-    char* p = buffer;
-    writeu8(&p, c);
-    *p = '\0';
+    int width = emu_wcwidth(c);
+    if (width > 0)
+        break_left(x, y);
+    x = put_char(x, y, c, width);
+    if (width > 0)
+        break_right(x, y);
+}
 
-    mvaddstr(y, x, buffer);
+/* Writes a UTF-8 string in the current attributes, returning the x
+ * coordinate after it. Control characters are ignored. */
+int dpy_writestring(int x, int y, const char* s, size_t size)
+{
+    const char* send = s + size;
+    bool written = false;
+    while (s < send)
+    {
+        uni_t c = readu8(&s);
+        int width = emu_wcwidth(c);
+        if ((width > 0) && !written)
+        {
+            break_left(x, y);
+            written = true;
+        }
+        x = put_char(x, y, c, width);
+    }
+    if (written)
+        break_right(x, y);
+    return x;
 }
 
 void dpy_cleararea(int x1, int y1, int x2, int y2)
 {
-    char cc = ' ';
+    x1 = std::max(x1, 0);
+    y1 = std::max(y1, 0);
+    x2 = std::min(x2, screenWidth - 1);
+    y2 = std::min(y2, screenHeight - 1);
+    if (x1 > x2)
+        return;
 
+    cell_t space = {' ', 0, (uint8_t)currentAttr, currentPair};
     for (int y = y1; y <= y2; y++)
+    {
+        break_left(x1, y);
         for (int x = x1; x <= x2; x++)
-            mvaddnstr(y, x, &cc, 1);
+            backBuffer[y * screenWidth + x] = space;
+        break_right(x2 + 1, y);
+    }
 }
 
 static int handle_mouse(void)
@@ -484,6 +701,20 @@ static int initscreen_cb(lua_State* L)
     return 0;
 }
 
+static int initfakescreen_cb(lua_State* L)
+{
+    fake = true;
+    use_colours = true;
+    colours.clear();
+    colourPairs.clear();
+    currentAttr = 0;
+    currentPair = 0;
+    screenWidth = forceinteger(L, 1);
+    screenHeight = forceinteger(L, 2);
+    resize_buffers(true);
+    return 0;
+}
+
 static int deinitscreen_cb(lua_State* L)
 {
     screen_deinit();
@@ -498,6 +729,13 @@ static int clearscreen_cb(lua_State* L)
 
 static int sync_cb(lua_State* L)
 {
+    if (fake)
+    {
+        lua_newtable(L);
+        flush_buffers(L);
+        return 1;
+    }
+
     dpy_setcursor(cursorx, cursory, cursorshown);
     dpy_sync();
     return 0;
@@ -582,17 +820,8 @@ static int write_cb(lua_State* L)
     int y = forceinteger(L, 2);
     size_t size;
     const char* s = luaL_checklstring(L, 3, &size);
-    const char* send = s + size;
-
-    while (s < send)
-    {
-        uni_t c = readu8(&s);
-        dpy_writeunichar(x, y, c);
-
-        if (!iswcntrl(c))
-            x += emu_wcwidth(c);
-    }
 
+    dpy_writestring(x, y, s, size);
     return 0;
 }
 
@@ -634,10 +863,8 @@ static int getscreensize_cb(lua_State* L)
     return 2;
 }
 
-static int getstringwidth_cb(lua_State* L)
+int getstringwidth(const char* s, size_t size)
 {
-    size_t size;
-    const char* s = luaL_checklstring(L, 1, &size);
     const char* send = s + size;
 
     int width = 0;
@@ -648,7 +875,15 @@ static int getstringwidth_cb(lua_State* L)
             width += emu_wcwidth(c);
     }
 
-    lua_pushnumber(L, width);
+    return width;
+}
+
+static int getstringwidth_cb(lua_State* L)
+{
+    size_t size;
+    const char* s = luaL_checklstring(L, 1, &size);
+
+    lua_pushnumber(L, getstringwidth(s, size));
     return 1;
 }
 
@@ -781,6 +1016,7 @@ void screen_init(const char* argv[])
 
     const static luaL_Reg funcs[] = {
         {"initscreen",          initscreen_cb         },
+        {"initfakescreen",      initfakescreen_cb     },
         {"deinitscreen",        deinitscreen_cb       },
         {"clearscreen",         clearscreen_cb        },
         {"sync",                sync_cb               },
@@ -262,16 +262,10 @@ static int escape_cb(lua_State* L)
     return 1;
 }
 
-static int unescape_cb(lua_State* L)
+std::string unescapestring(const char* inputbuffer, size_t inputbuffersize)
 {
-    size_t inputbuffersize;
-    const char* inputbuffer = luaL_checklstring(L, 1, &inputbuffersize);
-
     if (inputbuffersize == 0)
-    {
-        lua_pushlstring(L, nullptr, 0);
-        return 1;
-    }
+        return std::string();
 
     const size_t outputbuffersize = inputbuffersize; /* big enough to fit */
     std::vector<char> outputbuffer(outputbuffersize);
@@ -308,7 +302,38 @@ static int unescape_cb(lua_State* L)
         }
     }
 
-    lua_pushlstring(L, &outputbuffer[0], out - &outputbuffer[0]);
+    return std::string(&outputbuffer[0], out - &outputbuffer[0]);
+}
+
+static int unescape_cb(lua_State* L)
+{
+    size_t inputbuffersize;
+    const char* inputbuffer = luaL_checklstring(L, 1, &inputbuffersize);
+
+    std::string s = unescapestring(inputbuffer, inputbuffersize);
+    lua_pushlstring(L, s.data(), s.size());
+    return 1;
+}
+
+/* Returns a 64-bit FNV-1a hash of the input (a string or mapped file) as a
+ * hex string. This is for cache keys and change detection, not for
+ * security. */
+
+static int hash_cb(lua_State* L)
+{
+    size_t len;
+    const char* s = checkdata(L, 1, &len);
+
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= (uint8_t)s[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    char buffer[17];
+    snprintf(buffer, sizeof(buffer), "%016llx", (unsigned long long)hash);
+    lua_pushlstring(L, buffer, 16);
     return 1;
 }
 
@@ -321,6 +346,7 @@ void utils_init(void)
         {"time",      time_cb     },
         {"escape",    escape_cb   },
         {"unescape",  unescape_cb },
+        {"hash",      hash_cb     },
         {NULL,        NULL        }
     };
 
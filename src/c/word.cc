@@ -5,6 +5,8 @@
 
 #include "globals.h"
 #include <ctype.h>
+#include <algorithm>
+#include <limits.h>
 
 /* A 'word' is a string with embedded text style codes.
  *
@@ -87,63 +89,140 @@ static int parseword_cb(lua_State* L)
     return 0;
 }
 
-/* Draw a styled word at a particular location. */
+/* Draw a styled word at a particular location. oattr is the attribute the
+ * previous word ended with; the marked region runs from byte revon to byte
+ * revoff (1-based, and 0 for none). Returns the attribute the word ends
+ * with. */
 
-static int writestyled_cb(lua_State* L)
+static int writestyled(int x, int y, const char* s, size_t size, int oattr,
+    int revon_offset, int revoff_offset, int sor)
 {
-    int x = forceinteger(L, 1);
-    int y = forceinteger(L, 2);
-    size_t size;
-    const char* s = luaL_checklstring(L, 3, &size);
     const char* send = s + size;
-    int oattr = forceinteger(L, 4);
-    const char* revon = s + forceinteger(L, 5) - 1;
-    const char* revoff = s + forceinteger(L, 6) - 1;
-    int sor = forceinteger(L, 7);
+    const char* revon = s + revon_offset - 1;
+    const char* revoff = s + revoff_offset - 1;
 
     int attr = sor;
     int mark = 0;
 
-    dpy_setattr(0, sor);
+    /* The text is written a run at a time, where a run ends at a style
+     * byte or at either end of the marked region. */
     bool first = true;
     while (s < send)
     {
         if (s == revon)
-        {
             mark = DPY_REVERSE;
-            dpy_setattr(0, attr | mark);
-        }
         if (s == revoff)
-        {
             mark = 0;
-            dpy_setattr(0, attr | mark);
-        }
 
-        uni_t c = readu8(&s);
+        const char* runend = s;
+        while (runend < send)
+        {
+            const char* p = runend;
+            uni_t c = readu8(&p);
+            if (iswcntrl(c))
+                break;
+            runend = p;
+            if ((runend == revon) || (runend == revoff))
+                break;
+        }
 
-        if (iswcntrl(c))
+        if (runend == s)
         {
-            c &= STYLE_ALL;
+            uni_t c = readu8(&s) & STYLE_ALL;
             attr = c | sor;
-            dpy_setattr(0, attr | mark);
+            continue;
         }
-        else
-        {
-            if (first && (oattr & (DPY_REVERSE | DPY_UNDERLINE)) &&
-                ((attr | mark) == oattr))
-                dpy_writeunichar(x - 1, y, 160); /* non-breaking space */
 
-            dpy_writeunichar(x, y, c);
-            x += emu_wcwidth(c);
-            first = false;
-        }
+        dpy_setattr(0, attr | mark);
+        if (first && (oattr & (DPY_REVERSE | DPY_UNDERLINE)) &&
+            ((attr | mark) == oattr))
+            dpy_writeunichar(x - 1, y, 160); /* non-breaking space */
+
+        x = dpy_writestring(x, y, s, runend - s);
+        s = runend;
+        first = false;
     }
     dpy_setattr(0, 0);
 
-    lua_pushnumber(L, attr | mark);
+    return attr | mark;
+}
+
+static int writestyled_cb(lua_State* L)
+{
+    int x = forceinteger(L, 1);
+    int y = forceinteger(L, 2);
+    size_t size;
+    const char* s = luaL_checklstring(L, 3, &size);
+    int oattr = forceinteger(L, 4);
+    int revon = forceinteger(L, 5);
+    int revoff = forceinteger(L, 6);
+    int sor = forceinteger(L, 7);
+
+    lua_pushnumber(L, writestyled(x, y, s, size, oattr, revon, revoff, sor));
     return 1;
 }
 
+/* Draws one line of a wrapped paragraph: the words of the paragraph whose
+ * numbers are in line, each at its offset in xs, in the paragraph's style
+ * cstyle. decorations, if given, maps word numbers to extra attributes for
+ * that word. If w1 is given, the marked region runs from offset o1 of word
+ * w1 to offset o2 of word w2 (or to the end of the paragraph if there's no
+ * w2). */
+
+static int writeline_cb(lua_State* L)
+{
+    int x = forceinteger(L, 1);
+    int y = forceinteger(L, 2);
+    luaL_checktype(L, 3, LUA_TTABLE);
+    luaL_checktype(L, 4, LUA_TTABLE);
+    luaL_checktype(L, 5, LUA_TTABLE);
+    int cstyle = forceinteger(L, 6);
+    bool decorated = lua_istable(L, 7);
+    bool marked = !lua_isnoneornil(L, 8);
+    int w1 = forceinteger(L, 8);
+    int o1 = forceinteger(L, 9);
+    int w2 = lua_isnoneornil(L, 10) ? INT_MAX : forceinteger(L, 10);
+    int o2 = forceinteger(L, 11);
+
+    int count = lua_objlen(L, 5);
+    int oattr = 0;
+    for (int i = 1; i <= count; i++)
+    {
+        lua_rawgeti(L, 5, i);
+        int wn = forceinteger(L, -1);
+        lua_pop(L, 1);
+
+        lua_rawgeti(L, 4, wn);
+        int wx = forceinteger(L, -1);
+        lua_pop(L, 1);
+
+        int sor = cstyle;
+        if (decorated)
+        {
+            lua_rawgeti(L, 7, wn);
+            sor |= forceinteger(L, -1);
+            lua_pop(L, 1);
+        }
+
+        int revon = 0;
+        int revoff = 0;
+        if (marked && (wn >= w1) && (wn <= w2))
+        {
+            revon = (wn == w1) ? o1 : 1;
+            revoff = (wn == w2) ? o2 : 0;
+        }
+
+        lua_rawgeti(L, 3, wn);
+        size_t size;
+        const char* s = lua_tolstring(L, -1, &size);
+        if (s)
+            oattr = writestyled(x + wx, y, s, size, oattr, revon, revoff, sor);
+        lua_pop(L, 1);
+    }
+
+    return 0;
+}
+
 /* Returns the raw text of a word, with no styling. */
 
 static int getwordtext_cb(lua_State* L)
@@ -465,11 +544,412 @@ static int createstylebyte_cb(lua_State* L)
     return 1;
 }
 
+/* Fetches a word from the paragraph at stack index 1. The string remains
+ * anchored by the paragraph, so it's safe to use after popping it. */
+
+static const char* getparagraphword(lua_State* L, int wn, size_t* size)
+{
+    lua_rawgeti(L, 1, wn);
+    const char* word = lua_tolstring(L, -1, size);
+    lua_pop(L, 1);
+    if (!word)
+        luaL_error(L, "word %d is not a string", wn);
+    return word;
+}
+
+/* Returns the width a word takes up when wrapped, including the trailing
+ * space (and an extra one after full stops if the user asked for it). */
+
+static int getwrappedwidth(const char* word, size_t size, bool fullstopspaces)
+{
+    int ww = getstringwidth(word, size) + 1;
+    if (fullstopspaces && size && (word[size - 1] == '.'))
+        ww++;
+    return ww;
+}
+
+/* A word which doesn't end in a letter ends a sentence. */
+
+static bool endssentence(const char* word, size_t size)
+{
+    return size && !isalpha((uint8_t)word[size - 1]);
+}
+
+static void pushline(lua_State* L, int wn, int count)
+{
+    lua_createtable(L, count, 1);
+    for (int i = 0; i < count; i++)
+    {
+        lua_pushinteger(L, wn + i);
+        lua_rawseti(L, -2, i + 1);
+    }
+    lua_pushinteger(L, wn);
+    lua_setfield(L, -2, "wn");
+}
+
+static int getlinewn(lua_State* L, int lines, int ln)
+{
+    lua_rawgeti(L, lines, ln);
+    lua_getfield(L, -1, "wn");
+    int wn = lua_tointeger(L, -1);
+    lua_pop(L, 2);
+    return wn;
+}
+
+/* Moves the entries from..to (inclusive) of an array by delta places, in
+ * whichever direction doesn't overwrite entries which have yet to be moved,
+ * and clears any entries left vacated at the end. */
+
+static void shiftarray(lua_State* L, int t, int from, int to, int delta)
+{
+    if (delta > 0)
+    {
+        for (int i = to; i >= from; i--)
+        {
+            lua_rawgeti(L, t, i);
+            lua_rawseti(L, t, i + delta);
+        }
+    }
+    else if (delta < 0)
+    {
+        for (int i = from; i <= to; i++)
+        {
+            lua_rawgeti(L, t, i);
+            lua_rawseti(L, t, i + delta);
+        }
+        for (int i = to + delta + 1; i <= to; i++)
+        {
+            lua_pushnil(L);
+            lua_rawseti(L, t, i);
+        }
+    }
+}
+
+/* Updates an existing wrapdata table, at stack index wrapdata, in place
+ * after words first..last of the paragraph it was computed for have been
+ * replaced (changing the word count by delta). Wrapping restarts at the line
+ * containing the first changed word (or the one before, if the change is at
+ * the start of a line and might now fit there), and stops as soon as a line
+ * break lands on the start of one of the old lines past the change; the
+ * remaining lines are the old ones, renumbered. Returns false if the
+ * wrapdata can't be updated, in which case it's left untouched. */
+
+static bool rewrapparagraph(lua_State* L,
+    int count,
+    int width,
+    int indent2,
+    bool fullstopspaces,
+    int wrapdata,
+    int first,
+    int last,
+    int delta)
+{
+    int oldcount = count - delta;
+    if ((first < 1) || (last < (first - 1)) || (last > oldcount))
+        return false;
+
+    lua_getfield(L, wrapdata, "lines");
+    lua_getfield(L, wrapdata, "xs");
+    lua_getfield(L, wrapdata, "sentences");
+    int lines = lua_gettop(L) - 2;
+    int xs = lines + 1;
+    int sentences = lines + 2;
+    if (!lua_istable(L, lines) || !lua_istable(L, xs) ||
+        !lua_istable(L, sentences))
+    {
+        lua_pop(L, 3);
+        return false;
+    }
+    int nlines = lua_objlen(L, lines);
+
+    /* Find the last line starting at or before the first changed word. */
+
+    int lo = 1;
+    int hi = nlines;
+    int k = 0;
+    while (lo <= hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (getlinewn(L, lines, mid) <= first)
+        {
+            k = mid;
+            lo = mid + 1;
+        }
+        else
+            hi = mid - 1;
+    }
+
+    int r = k;
+    if ((k > 0) && (getlinewn(L, lines, k) == first))
+        r = k - 1;
+    if (r < 2)
+    {
+        /* The first line is special (different indent, and may be empty),
+         * so just let the caller rewrap from scratch. */
+        lua_pop(L, 3);
+        return false;
+    }
+
+    /* Rewrap from the start of line r. It's exactly as if the line had just
+     * been broken before its first word. */
+
+    width -= indent2;
+    int s = getlinewn(L, lines, r);
+    size_t size;
+    const char* word = getparagraphword(L, s, &size);
+
+    std::vector<int> newxs = {0};
+    std::vector<std::pair<int, int>> spans;
+    int linewn = s;
+    int linecount = 1;
+    int w = getwrappedwidth(word, size, fullstopspaces);
+    int oj = r;
+    int convergewn = 0;
+    int convergeline = 0;
+
+    for (int wn = s + 1; wn <= count; wn++)
+    {
+        word = getparagraphword(L, wn, &size);
+        int ww = getwrappedwidth(word, size, fullstopspaces);
+
+        int x = w;
+        w += ww;
+        if (w >= width)
+        {
+            spans.push_back({linewn, linecount});
+            linewn = wn;
+            linecount = 0;
+            w = ww;
+            x = 0;
+
+            /* Past the change, a break at the start of an old line means
+             * everything from here on is as it was. */
+
+            if (wn > (last + delta))
+            {
+                int o = wn - delta;
+                while ((oj <= nlines) && (getlinewn(L, lines, oj) < o))
+                    oj++;
+                if ((oj <= nlines) && (getlinewn(L, lines, oj) == o))
+                {
+                    convergewn = wn;
+                    convergeline = oj;
+                    break;
+                }
+            }
+        }
+
+        newxs.push_back(x);
+        linecount++;
+    }
+    if (!convergewn && (linecount > 0))
+        spans.push_back({linewn, linecount});
+
+    /* Move the surviving old lines and x offsets into place before
+     * overwriting anything with the new ones. */
+
+    if (convergewn)
+    {
+        int lineshift = r + spans.size() - convergeline;
+        shiftarray(L, lines, convergeline, nlines, lineshift);
+        if (delta != 0)
+        {
+            for (int ln = convergeline + lineshift;
+                ln <= (nlines + lineshift);
+                ln++)
+            {
+                lua_rawgeti(L, lines, ln);
+                int n = lua_objlen(L, -1);
+                for (int i = 1; i <= n; i++)
+                {
+                    lua_rawgeti(L, -1, i);
+                    int v = lua_tointeger(L, -1) + delta;
+                    lua_pop(L, 1);
+                    lua_pushinteger(L, v);
+                    lua_rawseti(L, -2, i);
+                }
+                lua_pushinteger(L, getlinewn(L, lines, ln) + delta);
+                lua_setfield(L, -2, "wn");
+                lua_pop(L, 1);
+            }
+        }
+
+        shiftarray(L, xs, convergewn - delta, oldcount, delta);
+    }
+    else
+    {
+        for (int ln = r + spans.size(); ln <= nlines; ln++)
+        {
+            lua_pushnil(L);
+            lua_rawseti(L, lines, ln);
+        }
+        for (int wn = count + 1; wn <= oldcount; wn++)
+        {
+            lua_pushnil(L);
+            lua_rawseti(L, xs, wn);
+        }
+    }
+
+    int ln = r;
+    for (auto& span : spans)
+    {
+        pushline(L, span.first, span.second);
+        lua_rawseti(L, lines, ln++);
+    }
+
+    int wn = s;
+    for (int x : newxs)
+    {
+        lua_pushinteger(L, x);
+        lua_rawseti(L, xs, wn++);
+    }
+
+    /* Sentence starts only depend on the previous word, so only the ones
+     * around the change need recomputing. */
+
+    shiftarray(L, sentences, last + 1, oldcount, delta);
+    int sfrom = std::max(first - 1, 1);
+    int sto = std::min(last + delta + 1, count);
+    for (int wn = sfrom; wn <= sto; wn++)
+    {
+        bool issentence = true;
+        if (wn > 1)
+        {
+            word = getparagraphword(L, wn - 1, &size);
+            issentence = endssentence(word, size);
+        }
+
+        if (issentence)
+            lua_pushboolean(L, true);
+        else
+            lua_pushnil(L);
+        lua_rawseti(L, sentences, wn);
+    }
+    lua_pushboolean(L, true);
+    lua_rawseti(L, sentences, count);
+
+    lua_pop(L, 3);
+    return true;
+}
+
+/* Word-wraps a paragraph. This is the inner loop of Paragraph.wrap, and must
+ * produce exactly what the Lua version used to: a list of lines (each being a
+ * table of word numbers, plus the number of the first word as .wn), the x
+ * offset of each word within its line, and the set of words which start
+ * sentences.
+ *
+ * wrapparagraph(paragraph, width, firstindent, indent, fullstopspaces,
+ *     [oldwrapdata, first, last, delta])
+ *   -> {lines = ..., xs = ..., sentences = ...}
+ *
+ * If oldwrapdata is supplied, it's the wrapping of an older version of the
+ * paragraph which differs only in words first..last, and is updated in place
+ * (and returned) if possible.
+ */
+
+static int wrapparagraph_cb(lua_State* L)
+{
+    luaL_checktype(L, 1, LUA_TTABLE);
+    int width = forceinteger(L, 2);
+    int indent1 = forceinteger(L, 3);
+    int indent2 = forceinteger(L, 4);
+    bool fullstopspaces = lua_toboolean(L, 5);
+
+    int count = lua_objlen(L, 1);
+
+    if (lua_istable(L, 6) && rewrapparagraph(L,
+                                 count,
+                                 width,
+                                 indent2,
+                                 fullstopspaces,
+                                 6,
+                                 forceinteger(L, 7),
+                                 forceinteger(L, 8),
+                                 forceinteger(L, 9)))
+    {
+        lua_pushvalue(L, 6);
+        return 1;
+    }
+
+    lua_createtable(L, 0, 3);
+    lua_createtable(L, count, 0); /* xs */
+    lua_createtable(L, 0, 0);     /* sentences */
+    lua_createtable(L, 0, 0);     /* lines */
+    int wrapdata = lua_gettop(L) - 3;
+    int xs = wrapdata + 1;
+    int sentences = wrapdata + 2;
+    int lines = wrapdata + 3;
+
+    /* Lines are built up as (first word, word count) pairs; the first line
+     * may be empty if the first word doesn't fit. */
+
+    std::vector<std::pair<int, int>> linespans;
+    int linewn = 1;
+    int linecount = 0;
+    int w = 0;
+    bool issentence = true;
+
+    width -= indent1;
+    for (int wn = 1; wn <= count; wn++)
+    {
+        size_t size;
+        const char* word = getparagraphword(L, wn, &size);
+
+        if (issentence)
+        {
+            lua_pushboolean(L, true);
+            lua_rawseti(L, sentences, wn);
+        }
+        issentence = endssentence(word, size);
+
+        int ww = getwrappedwidth(word, size, fullstopspaces);
+
+        int x = w;
+        w += ww;
+        if (w >= width)
+        {
+            linespans.push_back({linewn, linecount});
+            if (linespans.size() == 1)
+                width += indent1 - indent2;
+            linewn = wn;
+            linecount = 0;
+            w = ww;
+            x = 0;
+        }
+
+        lua_pushinteger(L, x);
+        lua_rawseti(L, xs, wn);
+        linecount++;
+    }
+
+    if (linecount > 0)
+        linespans.push_back({linewn, linecount});
+
+    if (count > 0)
+    {
+        lua_pushboolean(L, true);
+        lua_rawseti(L, sentences, count);
+    }
+
+    int ln = 1;
+    for (auto& span : linespans)
+    {
+        pushline(L, span.first, span.second);
+        lua_rawseti(L, lines, ln++);
+    }
+
+    lua_setfield(L, wrapdata, "lines");
+    lua_setfield(L, wrapdata, "sentences");
+    lua_setfield(L, wrapdata, "xs");
+    return 1;
+}
+
 void word_init(void)
 {
     const static luaL_Reg funcs[] = {
         {"parseword",        parseword_cb       },
         {"writestyled",      writestyled_cb     },
+        {"writeline",        writeline_cb       },
         {"getwordtext",      getwordtext_cb     },
         {"nextcharinword",   nextcharinword_cb  },
         {"prevcharinword",   prevcharinword_cb  },
@@ -478,6 +958,7 @@ void word_init(void)
         {"applystyletoword", applystyletoword_cb},
         {"getstylefromword", getstylefromword_cb},
         {"createstylebyte",  createstylebyte_cb },
+        {"wrapparagraph",    wrapparagraph_cb   },
         {NULL,               NULL               }
     };
 
@@ -5,103 +5,238 @@
 
 #include "globals.h"
 #include <zlib.h>
+#include <string.h>
+#include <algorithm>
 #include <vector>
 #include "unzip.h"
 #include "zip.h"
 
-static const int STACKSIZE = 64;
+/* zlib streams, which compress or decompress data a piece at a time, so that
+ * big files never need to be held in memory more than once. The output is
+ * collected into a luaL_Buffer, which grows geometrically. */
 
-static int decompress_cb(lua_State* L)
-{
-    size_t srcsize;
-    const char* srcbuffer = luaL_checklstring(L, 1, &srcsize);
-
-    int outputchunks = 0;
-    uint8_t outputbuffer[64 * 1024];
+#define ZSTREAM "wg.zstream"
+#define CHUNKSIZE (64 * 1024)
 
-    z_stream zs = {0};
-    int i = inflateInit(&zs);
-    if (i != Z_OK)
-        return 0;
-
-    zs.avail_in = srcsize;
-    zs.next_in = (uint8_t*)srcbuffer;
+/* Decompression accepts both zlib and gzip data. */
+#define INFLATEWINDOWBITS (MAX_WBITS + 32)
+#define GZIPWINDOWBITS (MAX_WBITS + 16)
 
-    luaL_checkstack(L, STACKSIZE, "out of memory");
+struct ZStream
+{
+    z_stream zs;
+    bool deflating;
+    bool open;
+};
+
+/* Runs len bytes of data through the stream, adding whatever comes out to
+ * the buffer. Returns the zlib status: Z_OK if the stream can carry on, or
+ * Z_STREAM_END when it's complete. */
+static int pump(
+    ZStream* z, luaL_Buffer* buffer, const char* data, size_t len, int flush)
+{
+    int i;
     do
     {
-        zs.avail_out = sizeof(outputbuffer);
-        zs.next_out = outputbuffer;
-
-        i = inflate(&zs, Z_NO_FLUSH);
-        switch (i)
+        /* avail_in is only 32 bits wide. */
+        size_t piece = std::min<size_t>(len, 1 << 30);
+        z->zs.next_in = (Bytef*)data;
+        z->zs.avail_in = piece;
+        data += piece;
+        len -= piece;
+        int f = len ? Z_NO_FLUSH : flush;
+
+        do
         {
-            case Z_NEED_DICT:
-            case Z_DATA_ERROR:
-            case Z_MEM_ERROR:
-                (void)inflateEnd(&zs);
-                return 0;
-        }
+            uint8_t chunk[CHUNKSIZE];
+            z->zs.next_out = chunk;
+            z->zs.avail_out = sizeof(chunk);
+
+            i = z->deflating ? deflate(&z->zs, f) : inflate(&z->zs, f);
+            luaL_addlstring(
+                buffer, (char*)chunk, sizeof(chunk) - z->zs.avail_out);
+
+            /* This just means that no progress was possible without more
+             * input. */
+            if (i == Z_BUF_ERROR)
+                i = Z_OK;
+        } while ((i == Z_OK) &&
+                 ((z->zs.avail_out == 0) || (z->zs.avail_in != 0) ||
+                     (z->deflating && (f == Z_FINISH))));
+    } while ((i == Z_OK) && len);
+
+    return i;
+}
 
-        int have = sizeof(outputbuffer) - zs.avail_out;
-        lua_pushlstring(L, (char*)outputbuffer, have);
-        outputchunks++;
+static bool initstream(ZStream* z, bool deflating, int level, bool gzip)
+{
+    memset(z, 0, sizeof(*z));
+    z->deflating = deflating;
+    int i;
+    if (deflating)
+        i = deflateInit2(&z->zs,
+            level,
+            Z_DEFLATED,
+            gzip ? GZIPWINDOWBITS : MAX_WBITS,
+            8,
+            Z_DEFAULT_STRATEGY);
+    else
+        i = inflateInit2(&z->zs, INFLATEWINDOWBITS);
+    z->open = (i == Z_OK);
+    return z->open;
+}
 
-        if (outputchunks == (STACKSIZE - 1))
-        {
-            /* Stack full! Concatenate what we've got, to empty the stack, and
-             * keep going. This will only happen on very large input files. */
-            lua_concat(L, outputchunks);
-            outputchunks = 1;
-        }
-    } while (i != Z_STREAM_END);
+static void endstream(ZStream* z)
+{
+    if (z->open)
+    {
+        if (z->deflating)
+            (void)deflateEnd(&z->zs);
+        else
+            (void)inflateEnd(&z->zs);
+        z->open = false;
+    }
+}
+
+static void zstream_dtor(void* p)
+{
+    endstream((ZStream*)p);
+}
+
+static ZStream* checkzstream(lua_State* L)
+{
+    ZStream* z = (ZStream*)luaL_checkudata(L, 1, ZSTREAM);
+    if (!z->open)
+        luaL_error(L, "stream is finished");
+    return z;
+}
 
-    (void)inflateEnd(&zs);
+/* Pushes a stream which will be ended when it's collected, even if an error
+ * is raised while it's in use. Returns nullptr if it couldn't be set up. */
+static ZStream* newzstream(lua_State* L, bool deflating, int level, bool gzip)
+{
+    ZStream* z =
+        (ZStream*)lua_newuserdatadtor(L, sizeof(ZStream), zstream_dtor);
+    z->open = false;
+    luaL_getmetatable(L, ZSTREAM);
+    lua_setmetatable(L, -2);
+    if (!initstream(z, deflating, level, gzip))
+        return nullptr;
+    return z;
+}
 
-    lua_concat(L, outputchunks);
+static int pushzstream(lua_State* L, bool deflating, int level, bool gzip)
+{
+    if (!newzstream(L, deflating, level, gzip))
+        luaL_error(L, "cannot create zlib stream");
     return 1;
 }
 
-static int compress_cb(lua_State* L)
+static int pushzstreamerror(lua_State* L, ZStream* z)
 {
-    size_t srcsize;
-    const char* srcbuffer = luaL_checklstring(L, 1, &srcsize);
+    lua_pushnil(L);
+    lua_pushstring(L, z->zs.msg ? z->zs.msg : "corrupt compressed data");
+    endstream(z);
+    return 2;
+}
 
-    int outputchunks = 0;
-    uint8_t outputbuffer[64 * 1024];
+/* Creates a compressor. level is the zlib compression level; if gzip is set,
+ * the output is a gzip file rather than a zlib stream. */
+static int createcompressor_cb(lua_State* L)
+{
+    int level = lua_isnoneornil(L, 1) ? Z_DEFAULT_COMPRESSION
+                                      : forceinteger(L, 1);
+    bool gzip = lua_toboolean(L, 2);
+    if ((level < Z_DEFAULT_COMPRESSION) || (level > Z_BEST_COMPRESSION))
+        luaL_argerror(L, 1, "bad compression level");
+    return pushzstream(L, true, level, gzip);
+}
 
-    z_stream zs = {0};
-    int i = deflateInit(&zs, 1);
-    if (i != Z_OK)
-        return 0;
+/* Creates a decompressor, which reads either zlib or gzip data. */
+static int createdecompressor_cb(lua_State* L)
+{
+    return pushzstream(L, false, 0, false);
+}
 
-    zs.avail_in = srcsize;
-    zs.next_in = (uint8_t*)srcbuffer;
+/* Feeds each of the strings into the stream, returning whatever output is
+ * ready so far (which may be nothing), or nil and a message. */
+static int zstream_feed_cb(lua_State* L)
+{
+    ZStream* z = checkzstream(L);
+    int count = lua_gettop(L);
 
-    luaL_checkstack(L, STACKSIZE, "out of memory");
-    do
+    luaL_Buffer buffer;
+    luaL_buffinit(L, &buffer);
+    for (int n = 2; n <= count; n++)
     {
-        zs.avail_out = sizeof(outputbuffer);
-        zs.next_out = outputbuffer;
+        size_t len;
+        const char* data = checkdata(L, n, &len);
+        int i = pump(z, &buffer, data, len, Z_NO_FLUSH);
+        if ((i != Z_OK) && (i != Z_STREAM_END))
+            return pushzstreamerror(L, z);
+    }
 
-        i = deflate(&zs, Z_FINISH);
+    luaL_pushresult(&buffer);
+    return 1;
+}
 
-        int have = sizeof(outputbuffer) - zs.avail_out;
-        lua_pushlstring(L, (char*)outputbuffer, have);
-        outputchunks++;
+/* Finishes the stream, returning the rest of the output, or nil and a
+ * message. The stream can't be used afterwards. */
+static int zstream_finish_cb(lua_State* L)
+{
+    ZStream* z = checkzstream(L);
 
-        if (outputchunks == (STACKSIZE - 1))
-        {
-            /* Stack full! Concatenate what we've got, to empty the stack, and
-             * keep going. This will only happen on very large input files. */
-            lua_concat(L, outputchunks);
-            outputchunks = 1;
-        }
-    } while (i != Z_STREAM_END);
+    luaL_Buffer buffer;
+    luaL_buffinit(L, &buffer);
+    int i = pump(z, &buffer, nullptr, 0, Z_FINISH);
+    if (i != Z_STREAM_END)
+    {
+        if (i == Z_OK)
+            z->zs.msg = (char*)"truncated compressed data";
+        return pushzstreamerror(L, z);
+    }
+
+    endstream(z);
+    luaL_pushresult(&buffer);
+    return 1;
+}
+
+static int decompress_cb(lua_State* L)
+{
+    size_t srcsize;
+    const char* srcbuffer = checkdata(L, 1, &srcsize);
+
+    ZStream* z = newzstream(L, false, 0, false);
+    if (!z)
+        return 0;
 
-    (void)deflateEnd(&zs);
+    luaL_Buffer buffer;
+    luaL_buffinit(L, &buffer);
+    int i = pump(z, &buffer, srcbuffer, srcsize, Z_NO_FLUSH);
+    endstream(z);
+    if (i != Z_STREAM_END)
+        return 0;
 
-    lua_concat(L, outputchunks);
+    luaL_pushresult(&buffer);
+    return 1;
+}
+
+static int compress_cb(lua_State* L)
+{
+    size_t srcsize;
+    const char* srcbuffer = luaL_checklstring(L, 1, &srcsize);
+    int level = lua_isnoneornil(L, 2) ? 1 : forceinteger(L, 2);
+
+    ZStream* z = newzstream(L, true, level, false);
+    if (!z)
+        return 0;
+
+    luaL_Buffer buffer;
+    luaL_buffinit(L, &buffer);
+    pump(z, &buffer, srcbuffer, srcsize, Z_FINISH);
+    endstream(z);
+
+    luaL_pushresult(&buffer);
     return 1;
 }
 
@@ -151,8 +286,6 @@ static int writezip_cb(lua_State* L)
         while (lua_next(L, 2) != 0)
         {
             const char* key = lua_tostring(L, -2);
-            size_t valuelen;
-            const char* value = lua_tolstring(L, -1, &valuelen);
 
             int i = zipOpenNewFileInZip(zf,
                 key,
@@ -170,7 +303,26 @@ static int writezip_cb(lua_State* L)
                 break;
             }
 
-            i = zipWriteInFileInZip(zf, value, valuelen);
+            /* Each value is a string or an array of strings. */
+            if (lua_type(L, -1) == LUA_TTABLE)
+            {
+                int count = lua_objlen(L, -1);
+                for (int j = 1; (j <= count) && (i == ZIP_OK); j++)
+                {
+                    lua_rawgeti(L, -1, j);
+                    size_t valuelen;
+                    const char* value = lua_tolstring(L, -1, &valuelen);
+                    if (value)
+                        i = zipWriteInFileInZip(zf, value, valuelen);
+                    lua_pop(L, 1);
+                }
+            }
+            else
+            {
+                size_t valuelen;
+                const char* value = lua_tolstring(L, -1, &valuelen);
+                i = zipWriteInFileInZip(zf, value, valuelen);
+            }
             if (i != ZIP_OK)
             {
                 result = 0;
@@ -198,12 +350,26 @@ static int writezip_cb(lua_State* L)
 
 void zip_init(void)
 {
+    const static luaL_Reg zstreammethods[] = {
+        {"feed",   zstream_feed_cb  },
+        {"finish", zstream_finish_cb},
+        {NULL,     NULL             }
+    };
+
+    luaL_newmetatable(L, ZSTREAM);
+    lua_newtable(L);
+    luaL_register(L, nullptr, zstreammethods);
+    lua_setfield(L, -2, "__index");
+    lua_pop(L, 1);
+
     const static luaL_Reg funcs[] = {
-        {"compress",    compress_cb   },
-        {"decompress",  decompress_cb },
-        {"readfromzip", readfromzip_cb},
-        {"writezip",    writezip_cb   },
-        {NULL,          NULL          }
+        {"compress",           compress_cb          },
+        {"createcompressor",   createcompressor_cb  },
+        {"createdecompressor", createdecompressor_cb},
+        {"decompress",         decompress_cb        },
+        {"readfromzip",        readfromzip_cb       },
+        {"writezip",           writezip_cb          },
+        {NULL,                 NULL                 }
     };
 
     luaL_register(L, "wg", funcs);
@@ -12,6 +12,26 @@ export type Stat = {
 	mode: string
 }
 
+export type FileHandle = {
+	write: (FileHandle, ...string) -> (boolean?, string?, number?),
+	flush: (FileHandle) -> (boolean?, string?, number?),
+	sync: (FileHandle) -> (boolean?, string?, number?),
+	close: (FileHandle) -> (boolean?, string?, number?),
+}
+
+-- A read-only view of a file, which behaves enough like a string for the
+-- native loaders (and # and sub()).
+export type MappedFile = {
+	sub: (MappedFile, number, number?) -> string,
+}
+
+export type Source = string | MappedFile
+
+export type ZStream = {
+	feed: (ZStream, ...Source) -> (string?, string?),
+	finish: (ZStream) -> (string?, string?),
+}
+
 export type Markdown = any
 export type MarkdownIterator = any
 
@@ -24,13 +44,18 @@ declare wg: {
 	cleartoeol: () -> (),
 	clipboard_get: () -> (string?, string?),
 	clipboard_set: (string?, string?) -> (),
-	compress: (string) -> string,
+	compile: (string, string?) -> (string?, string?),
+	compress: (string, number?) -> string,
+	createcompressor: (number?, boolean?) -> ZStream,
+	createdecompressor: () -> ZStream,
 	createstylebyte: (number) -> string,
-	decompress: (string) -> string,
+	decompress: (Source) -> string?,
 	deinitscreen: () -> (),
 	deletefromword: (string, number, number) -> string,
 	escape: (string) -> string,
 	exit: (number) -> (),
+	exitchild: (number) -> (),
+	fork: () -> (number?, string?, number?),
 	getboundedstring: (string, number) -> string,
 	getbytesofcharacter: (number) -> number,
 	getchar: (number?) -> InputEvent,
@@ -42,12 +67,20 @@ declare wg: {
 	getwordtext: (string) -> string,
 	getwordtext: (string) -> string,
 	gotoxy: (number, number) -> (),
+	hash: (Source) -> string,
 	hidecursor: () -> (),
+	initfakescreen: (number, number) -> (),
 	initscreen: () -> (),
 	insertintoword: (string, string, number, number) -> (string, number?, number?),
+	loadbinarydump: (Source, DocumentSet, () -> Document, any) -> boolean,
+	loadbytecode: (string, string?) -> (((...any) -> ...any)?, string?),
+	loadtextdumpfile: (Source, number, DocumentSet, () -> Document, any, boolean?) -> (),
+	loadtextparagraphs: (Source, number, Document, any, number?, number?, any?) -> (),
+	mapfile: (string) -> (MappedFile?, string?, number?),
 	mkdir: (string) -> (boolean, string?, number?),
 	mkdirs: (string) -> (boolean, string?, number?),
 	nextcharinword: (string, number) -> number?,
+	openfile: (string, string?) -> (FileHandle?, string?, number?),
 	parseword: (string, number, (number, string) -> ()) -> (),
 	prevcharinword: (string, number) -> number?,
 	printerr: (...string) -> (),
@@ -68,16 +101,23 @@ declare wg: {
 	setunicode: (boolean) -> (),
 	showcursor: () -> (),
 	stat: (string) -> (Stat?, string?, number?),
-	sync: () -> (),
+	sync: () -> {{x: number, y: number, attr: number, pair: number, text: string}}?,
 	time: () -> number,
 	transcode: (string) -> string,
 	unescape: (string) -> string,
 	useunicode: () -> boolean,
+	waitpid: (number) -> ((number | boolean)?, string?, number?),
 	write: (number, number, string) -> (),
-	writefile: (string, string) -> (boolean, string?, number?),
+	writebinarydumpfile: (string, string, {Document}) -> (boolean?, string?, number?),
+	writefile: (string, string | {string}) -> (boolean?, string?, number?),
+	writeline: (number, number, {string}, {number}, {number}, number,
+		{[number]: number}?, number?, number?, number?, number?) -> (),
 	writestyled: (number, number, string, number, number, number, number) -> number,
 	writeu8: (number) -> string,
-	writezip: (string, {[string]: string}) -> boolean?,
+	wrapparagraph: (any, number, number, number, boolean) -> any,
+	writezip: (string, {[string]: string | {string}}) -> boolean?,
+
+	BYTECODEVERSION: number,
 
 	BOLD: number,
 	BRIGHT: number,
@@ -4,6 +4,12 @@
 -- file in this distribution for the full text.
 
 local Stat = wg.stat
+local Fork = wg.fork
+local WaitPid = wg.waitpid
+local ExitChild = wg.exitchild
+
+-- The autosave being written in the background, if there is one.
+local child: {pid: number, filename: string}? = nil
 
 local function announce()
 	local settings = documentSet.addons.autosave
@@ -36,12 +42,78 @@ local function makefilename(pattern: string)
 end
 
 -----------------------------------------------------------------------------
--- Idle handler. This actually does the work of autosaving.
+-- Writing the autosave.
+
+local function autosaved(filename: string)
+	NonmodalMessage("Autosaved as "..filename)
+	QueueRedraw()
+	FireEvent("Autosaved", filename)
+end
+
+local function save(filename: string)
+	ImmediateMessage("Autosaving...")
+	local r, e = SaveDocumentSetRaw(filename)
+
+	if not r then
+		assert(e)
+		ModalMessage("Autosave failed", "The document could not be autosaved: "..e)
+	else
+		autosaved(filename)
+	end
+end
+
+-- Writes the autosave from a forked copy of the process, which has a
+-- snapshot of the document set as it was at the fork, so that the user can
+-- carry on working while it's written. Returns false if the platform can't
+-- do this.
+local function savebackground(filename: string): boolean
+	local pid = Fork()
+	if not pid then
+		return false
+	end
+
+	if pid == 0 then
+		-- File handles inherited from the parent (such as the journal's)
+		-- are left alone if they're collected here; see wg.openfile().
+		local ok, r = pcall(SaveDocumentSetRaw, filename)
+		ExitChild((ok and r) and 0 or 1)
+	end
+
+	child = { pid = pid, filename = filename }
+	return true
+end
+
+-- Checks whether the background autosave has finished.
+local function poll()
+	if not child then
+		return
+	end
+
+	local status = WaitPid(child.pid)
+	if status == false then
+		return
+	end
+
+	local filename = child.filename
+	child = nil
+	if status == 0 then
+		autosaved(filename)
+	else
+		-- The child can't say what went wrong, so try again in the
+		-- foreground, which can.
+		save(filename)
+	end
+end
+
+-----------------------------------------------------------------------------
+-- Idle handler. This decides when to autosave.
 
 do
 	local function cb()
+		poll()
+
 		local settings = documentSet.addons.autosave
-		if not settings.enabled or not documentSet._changed then
+		if not settings.enabled or not documentSet._changed or child then
 			return
 		end
 		
@@ -55,17 +127,9 @@ do
 		end
 
 		if ((os.time() - settings.lastsaved) > (settings.period * 60)) then
-			ImmediateMessage("Autosaving...")
-			
 			local filename = makefilename(settings.pattern)
-			local r, e = SaveDocumentSetRaw(filename)
-			
-			if not r then
-				assert(e)
-				ModalMessage("Autosave failed", "The document could not be autosaved: "..e)
-			else
-				NonmodalMessage("Autosaved as "..filename) 
-				QueueRedraw()
+			if not savebackground(filename) then
+				save(filename)
 			end
 			
 			settings.lastsaved = os.time()
@@ -75,6 +139,16 @@ do
 	AddEventListener("Idle", cb)
 end
 
+-- A background autosave may finish while the user is typing.
+
+do
+	local function cb()
+		poll()
+	end
+
+	AddEventListener("WaitingForUser", cb)
+end
+
 -----------------------------------------------------------------------------
 -- Load document. Nukes the 'last autosave' field 
 
@@ -0,0 +1,70 @@
+--!nonstrict
+-- © 2025 David Given.
+-- WordGrinder is licensed under the MIT open source license. See the COPYING
+-- file in this distribution for the full text.
+
+-- Chooses the format the document set is saved in: the v3 text format,
+-- which can be diffed and edited by hand, or the v4 binary one (see
+-- dumpfile.cc), which is much quicker to load for very big document sets.
+
+-----------------------------------------------------------------------------
+-- Addon registration. Create the default settings in the documentSet.
+
+do
+	local function cb()
+		documentSet.addons.fileformat = documentSet.addons.fileformat or {
+			binary = false,
+		}
+	end
+
+	AddEventListener("RegisterAddons", cb)
+end
+
+-----------------------------------------------------------------------------
+-- Configuration user interface.
+
+function Cmd.ConfigureFileFormat()
+	local settings = documentSet.addons.fileformat
+
+	local binary_checkbox =
+		Form.Checkbox {
+			x1 = 1, y1 = 1,
+			x2 = -1, y2 = 1,
+			label = "Save in the binary file format",
+			value = settings.binary
+		}
+
+	local dialogue: Form =
+	{
+		title = "Configure File Format",
+		width = "large",
+		height = 5,
+		stretchy = false,
+
+		actions = {
+			["KEY_RETURN"] = "confirm",
+			["KEY_ENTER"] = "confirm",
+		},
+
+		widgets = {
+			binary_checkbox,
+
+			Form.WrappedLabel {
+				x1 = 1, y1 = 3,
+				x2 = -1, y2 = 4,
+				value = "Binary files load much faster, but can't be diffed "..
+					"or read by older versions of WordGrinder."
+			},
+		}
+	}
+
+	local result = Form.Run(dialogue, RedrawScreen,
+		"SPACE to toggle, RETURN to confirm, "..ESCAPE_KEY.." to cancel")
+	if not result then
+		return false
+	end
+
+	settings.binary = binary_checkbox.value
+	documentSet:touch()
+	return true
+end
@@ -0,0 +1,653 @@
+--!nonstrict
+-- © 2025 David Given.
+-- WordGrinder is licensed under the MIT open source license. See the COPYING
+-- file in this distribution for the full text.
+
+-- The crash recovery journal. After each command, the paragraphs it changed
+-- are appended to a journal file next to the document set, and saving the
+-- document set throws the journal away. If WordGrinder dies before the
+-- document set is saved, the journal is replayed the next time it's loaded.
+--
+-- The journal is a text file. The first line is JMAGIC and the second is the
+-- hash of the saved file which the journal applies to (if the file's since
+-- changed, the journal isn't replayed). Each line after that is one of:
+--
+--   @"name"           the following lines apply to the named document
+--   +pn               insert an empty paragraph before paragraph pn
+--   -pn               delete paragraph pn
+--   =pn style words   replace paragraph pn
+--   #count            the document now has count paragraphs
+--   >"name"           rename the document
+--   !                 delete the document
+--
+-- Documents added during the session are recreated from their paragraphs;
+-- anything else about them, such as their order, needs a save.
+-- The journal is written with buffered IO, and is only guaranteed to be on
+-- the disk once it's been synced, which happens at most every syncperiod
+-- seconds (and whenever the user stops typing).
+
+local Escape = wg.escape
+local Unescape = wg.unescape
+local OpenFile = wg.openfile
+local ReadFile = wg.readfile
+local MapFile = wg.mapfile
+local Hash = wg.hash
+local Remove = wg.remove
+local Time = wg.time
+local table_concat = table.concat
+local unpack = rawget(_G, "unpack") or table.unpack
+
+local JMAGIC = "WordGrinder journal v1"
+
+local fp: FileHandle? = nil
+local filename: string? = nil -- of the journal, if there is one
+local append = false -- whether a new fp continues an existing journal
+local suspended = false -- if set, nothing is journalled until the next save
+local lastdocument: Document? = nil -- the document named by the last @ line
+local basehash: string? = nil -- of the saved file, found when it's loaded or saved
+local lastsync = 0
+local unsynced = false
+
+local function journalname(): string?
+	local name = documentSet.name
+	if not name then
+		return nil
+	end
+	return name..".journal"
+end
+
+-- Identifies the saved document set which a journal applies to. This reads
+-- the whole file, so it's only done when it's loaded or saved.
+local function filehash(name: string): string?
+	local data = MapFile(name) or ReadFile(name)
+	return data and Hash(data)
+end
+
+local function close()
+	if fp then
+		fp:close()
+		fp = nil
+	end
+	lastdocument = nil
+	unsynced = false
+end
+
+-- Stops journalling, and removes the journal.
+local function discard()
+	close()
+	if filename then
+		Remove(filename)
+		filename = nil
+	end
+	append = false
+end
+
+local function fail(e: string)
+	close()
+	suspended = true
+	NonmodalMessage("Crash recovery journal failed: "..e)
+end
+
+local function open(): boolean
+	if fp then
+		return true
+	end
+
+	local name = journalname()
+	if name and not append and not basehash then
+		-- (The journal was turned on some other way than the settings.)
+		basehash = filehash(assert(documentSet.name))
+	end
+	if not name or not (append or basehash) then
+		-- The document set's never been saved, so there's nothing to replay
+		-- the journal onto.
+		return false
+	end
+
+	local f, e = OpenFile(name, append and "a" or "w")
+	if not f then
+		fail(e or "cannot open file")
+		return false
+	end
+	if not append then
+		f:write(JMAGIC, "\n", assert(basehash), "\n")
+	end
+
+	fp = f
+	filename = name
+	append = true
+	lastsync = Time()
+	return true
+end
+
+local function sync(force: boolean)
+	local settings = documentSet.addons.journal
+	if fp and unsynced
+			and (force or ((Time() - lastsync) >= settings.syncperiod)) then
+		local _, e = fp:sync()
+		if e then
+			fail(e)
+			return
+		end
+		unsynced = false
+		lastsync = Time()
+	end
+end
+
+local function writelines(lines: {string})
+	if (#lines == 0) or not open() then
+		return
+	end
+
+	local _, e = assert(fp):write(table_concat(lines))
+	if e then
+		fail(e)
+		return
+	end
+	unsynced = true
+	sync(false)
+end
+
+local function paragraphline(pn: number, p: Paragraph): string
+	if #p == 0 then
+		return "="..pn.." "..p.style.."\n"
+	end
+	return "="..pn.." "..p.style.." "..table_concat(p, " ").."\n"
+end
+
+-----------------------------------------------------------------------------
+-- Replays a journal onto the current document set. Returns the number of
+-- documents changed, or nil and a message if the journal's unusable (in which
+-- case nothing is changed).
+
+local function replay(data: string): (number?, string?)
+	local lines = data:gmatch("([^\n]*)\n")
+	if lines() ~= JMAGIC then
+		return nil, "not a journal"
+	end
+	if not basehash or (lines() ~= basehash) then
+		return nil, "the document set has been changed since it was written"
+	end
+
+	-- The whole journal is checked first, against a model of the document
+	-- set which just knows how many paragraphs each document has.
+	type Op = {
+		c: string,
+		name: string?,
+		newname: string?,
+		pn: number?,
+		words: {string}?,
+	}
+	local ops: {Op} = {}
+	local ok, e = pcall(function()
+		local counts: {[string]: number | false} = {}
+		local documents = #documentSet.documents
+		local function count(name: string): number?
+			local n = counts[name]
+			if n == nil then
+				local d = documentSet:findDocument(name)
+				n = d and #d:materialise() or false
+				counts[name] = n
+			end
+			return n or nil
+		end
+
+		-- A partial last line is a write which never finished, and is
+		-- ignored.
+		local name: string? = nil
+		for line in lines do
+			local c = line:sub(1, 1)
+			local op: Op = { c = c, name = name }
+			if c == "@" then
+				name = Unescape(line:sub(3, -2))
+				if not count(name) then
+					-- The journal also contains the empty paragraph which
+					-- new documents are created with.
+					counts[name] = 0
+					documents = documents + 1
+				end
+				op.name = name
+			elseif c == ">" then
+				local oldname = assert(name, "change outside document")
+				local newname = Unescape(line:sub(3, -2))
+				assert(not count(newname), "document already exists")
+				counts[newname] = counts[oldname]
+				counts[oldname] = false
+				op.newname = newname
+				name = newname
+			elseif c == "!" then
+				assert(name, "change outside document")
+				assert(documents > 1, "can't delete the last document")
+				counts[name] = false
+				documents = documents - 1
+				name = nil
+			else
+				local n = assert(name and count(name), "change outside document")
+				local pn = assert(tonumber(line:match("^.(%d+)")), "bad line")
+				if c == "#" then
+					n = pn
+				elseif c == "+" then
+					assert((pn >= 1) and (pn <= (n + 1)), "bad paragraph")
+					n = n + 1
+				elseif c == "-" then
+					assert((pn >= 1) and (pn <= n), "bad paragraph")
+					n = n - 1
+				elseif c == "=" then
+					assert((pn >= 1) and (pn <= n), "bad paragraph")
+					op.words = SplitString(
+						assert(line:match("^=%d+ (.*)$"), "bad line"), " ")
+				else
+					error("bad line")
+				end
+				counts[assert(name)] = n
+				op.pn = pn
+			end
+			ops[#ops+1] = op
+		end
+	end)
+	if not ok then
+		return nil, e
+	end
+
+	local changed: {[Document]: boolean} = {}
+	local deleted = 0
+	local document: Document? = nil
+	for _, op in ops do
+		local c = op.c
+		if c == "@" then
+			local name = assert(op.name)
+			document = documentSet:findDocument(name)
+			if not document then
+				document = documentSet:addDocument(CreateDocument(), name)
+				assert(document):deleteParagraphAt(1)
+				changed[assert(document)] = true
+			end
+			assert(document):materialise()
+		elseif c == ">" then
+			documentSet:renameDocument(op.name, op.newname)
+			changed[assert(document)] = true
+		elseif c == "!" then
+			documentSet:deleteDocument(op.name)
+			changed[assert(document)] = nil
+			deleted = deleted + 1
+			document = nil
+		else
+			local d = assert(document)
+			local pn = assert(op.pn)
+			if c == "#" then
+				while #d > pn do
+					d:deleteParagraphAt(#d)
+				end
+				while #d < pn do
+					d:appendParagraph(CreateParagraph("P"))
+				end
+			elseif c == "+" then
+				d:insertParagraphBefore(CreateParagraph("P"), pn)
+			elseif c == "-" then
+				d:deleteParagraphAt(pn)
+			else
+				d:setParagraph(pn, CreateParagraph(unpack(assert(op.words))))
+			end
+			changed[d] = true
+		end
+	end
+
+	local count = deleted
+	for d in changed do
+		count = count + 1
+
+		if #d == 0 then
+			d:appendParagraph(CreateParagraph("P"))
+		end
+
+		-- These changes are already in the journal, so mustn't be logged.
+		d:invalidateCounts()
+		d._changes = nil
+		if d.cp > #d then
+			d.cp = #d
+			d.cw = 1
+			d.co = 1
+		end
+		local p = d[d.cp]
+		if d.cw > #p then
+			d.cw = 1
+			d.co = 1
+		elseif p[d.cw] and (d.co > (#p[d.cw] + 1)) then
+			d.co = 1
+		end
+	end
+
+	return count
+end
+
+-----------------------------------------------------------------------------
+-- Journals the changes made by each command.
+
+do
+	-- Adds the lines which journal one document's changes to lines.
+	local function journaldocument(lines: {string}, document: Document,
+			changes: ChangeLog)
+		if not document._changed then
+			-- (If the document hasn't changed since it was loaded or saved,
+			-- these can't be real changes.)
+			return
+		end
+		if not changes.all and (#changes == 0) then
+			return
+		end
+
+		if document ~= lastdocument then
+			lines[#lines+1] = '@"'..Escape(document.name)..'"\n'
+			lastdocument = document
+		end
+
+		-- Structural changes are written in order; then the contents of
+		-- every paragraph which was changed or inserted, wherever it ended
+		-- up.
+		local touched: {[number]: boolean} = {}
+		if changes.all then
+			lines[#lines+1] = "#"..#document.."\n"
+			for pn = 1, #document do
+				touched[pn] = true
+			end
+		else
+			for _, c in changes do
+				local pn = c.pn
+				if c.kind == "changed" then
+					touched[pn] = true
+				else
+					local delta = (c.kind == "inserted") and 1 or -1
+					local t = {}
+					for tpn in touched do
+						if tpn > pn then
+							t[tpn + delta] = true
+						elseif tpn < pn then
+							t[tpn] = true
+						elseif c.kind == "inserted" then
+							t[tpn + 1] = true
+						end
+					end
+					touched = t
+
+					if c.kind == "inserted" then
+						lines[#lines+1] = "+"..pn.."\n"
+						touched[pn] = true
+					else
+						lines[#lines+1] = "-"..pn.."\n"
+					end
+				end
+			end
+		end
+
+		local pns = {}
+		for pn in touched do
+			if document[pn] then
+				pns[#pns+1] = pn
+			end
+		end
+		table.sort(pns)
+		for _, pn in pns do
+			lines[#lines+1] = paragraphline(pn, document[pn])
+		end
+	end
+
+	local function cb(event, token, changes: ChangeLog?)
+		local settings = documentSet.addons.journal
+		if not settings or not settings.enabled or suspended then
+			return
+		end
+
+		local lines = {}
+		if changes then
+			journaldocument(lines, currentDocument, changes)
+		end
+
+		-- Commands can change other documents too (such as the user
+		-- dictionary), and nothing else takes their changes until they
+		-- become current.
+		for _, d in documentSet.documents do
+			if (d ~= currentDocument) and d._changes then
+				journaldocument(lines, d, d:takeChanges())
+			end
+		end
+
+		writelines(lines)
+	end
+
+	AddEventListener("Changed", cb)
+end
+
+-- Renaming and deleting documents are journalled as they happen.
+
+do
+	local function cb(event, token, document: Document, oldname: string?)
+		local settings = documentSet.addons.journal
+		if not settings or not settings.enabled or suspended then
+			return
+		end
+
+		local lines = {}
+		if event == "DocumentRenamed" then
+			lines[1] = '@"'..Escape(assert(oldname))..'"\n'
+			lines[2] = '>"'..Escape(document.name)..'"\n'
+			lastdocument = document
+		else
+			-- Changes to the document which haven't been journalled yet
+			-- don't matter any more.
+			document:takeChanges()
+			lines[1] = '@"'..Escape(document.name)..'"\n'
+			lines[2] = "!\n"
+			lastdocument = nil
+		end
+		writelines(lines)
+	end
+
+	AddEventListener("DocumentRenamed", cb)
+	AddEventListener("DocumentDeleted", cb)
+end
+
+do
+	local function cb()
+		sync(true)
+	end
+
+	AddEventListener("Idle", cb)
+end
+
+-----------------------------------------------------------------------------
+-- Saving makes the journal redundant.
+
+do
+	local function cb()
+		discard()
+
+		-- Any journal under the new name is out of date too.
+		local name = journalname()
+		if name then
+			Remove(name)
+		end
+		suspended = false
+
+		-- Changes not yet journalled are in the file now.
+		for _, d in documentSet.documents do
+			if d ~= currentDocument then
+				d._changes = nil
+			end
+		end
+
+		local settings = documentSet.addons.journal
+		basehash = nil
+		if settings and settings.enabled then
+			basehash = filehash(assert(documentSet.name))
+		end
+	end
+
+	AddEventListener("DocumentSaved", cb)
+end
+
+-----------------------------------------------------------------------------
+-- Loading a document set throws away the old one (and its journal), and
+-- replays the new one's journal if there is one.
+
+do
+	local function cb()
+		discard()
+		suspended = false
+
+		-- Documents loaded from older file formats can't be journalled until
+		-- they've been saved in the current one.
+		for _, d in documentSet.documents do
+			if d._changed then
+				suspended = true
+			end
+		end
+
+		local name = journalname()
+		local data = name and ReadFile(name)
+		local settings = documentSet.addons.journal
+		basehash = nil
+		if name and not suspended and (data or (settings and settings.enabled)) then
+			basehash = filehash(assert(documentSet.name))
+		end
+		if not name or not data or suspended then
+			return
+		end
+
+		-- Nothing done while replaying is journalled again.
+		suspended = true
+		local count, e = replay(data)
+		if not count then
+			-- The journal's kept, in case it can be used some other way.
+			ModalMessage("Crash recovery failed",
+				"There's a crash recovery journal for this document set, "..
+				"but it couldn't be used ("..e.."). It has been left "..
+				"where it is, but will be replaced when the document set "..
+				"is next saved; until then, changes won't be journalled.")
+			return
+		end
+		suspended = false
+
+		-- Carry on adding to the existing journal.
+		filename = name
+		append = true
+		if count > 0 then
+			documentSet:touch()
+			QueueRedraw()
+			NonmodalMessage("Recovered unsaved changes to "..count..
+				" document"..Pluralise(count, "", "s").." from the crash "..
+				"recovery journal.")
+		end
+	end
+
+	AddEventListener("DocumentLoaded", cb)
+end
+
+do
+	local function cb()
+		discard()
+		suspended = false
+	end
+
+	AddEventListener("DocumentCreated", cb)
+	AddEventListener("Exit", cb)
+end
+
+-----------------------------------------------------------------------------
+-- Addon registration. Create the default settings in the documentSet.
+
+do
+	local function cb()
+		documentSet.addons.journal = documentSet.addons.journal or {
+			enabled = false,
+			syncperiod = 5,
+		}
+	end
+
+	AddEventListener("RegisterAddons", cb)
+end
+
+-----------------------------------------------------------------------------
+-- Configuration user interface.
+
+function Cmd.ConfigureJournal()
+	local settings = documentSet.addons.journal
+
+	local enabled_checkbox =
+		Form.Checkbox {
+			x1 = 1, y1 = 1,
+			x2 = -1, y2 = 1,
+			label = "Keep a crash recovery journal",
+			value = settings.enabled
+		}
+
+	local period_textfield =
+		Form.TextField {
+			x1 = 33, y1 = 3,
+			x2 = -1, y2 = 3,
+			value = tostring(settings.syncperiod)
+		}
+
+	local dialogue: Form =
+	{
+		title = "Configure Crash Recovery",
+		width = "large",
+		height = 5,
+		stretchy = false,
+
+		actions = {
+			["KEY_RETURN"] = "confirm",
+			["KEY_ENTER"] = "confirm",
+		},
+
+		widgets = {
+			enabled_checkbox,
+
+			Form.Label {
+				x1 = 1, y1 = 3,
+				x2 = 32, y2 = 3,
+				align = "left",
+				value = "Max seconds between syncs:"
+			},
+			period_textfield,
+		}
+	}
+
+	while true do
+		local result = Form.Run(dialogue, RedrawScreen,
+			"SPACE to toggle, RETURN to confirm, "..ESCAPE_KEY.." to cancel")
+		if not result then
+			return false
+		end
+
+		local enabled = enabled_checkbox.value
+		local period = tonumber(period_textfield.value)
+
+		if not period or (period < 0) then
+			ModalMessage("Parameter error", "The sync period must be a valid number.")
+		else
+			local wasenabled = settings.enabled
+			settings.enabled = enabled
+			settings.syncperiod = period
+			documentSet:touch()
+
+			if not enabled then
+				discard()
+				basehash = nil
+			elseif not documentSet.name then
+				NonmodalMessage("The journal will start once the document set has been saved.")
+			elseif not wasenabled then
+				if documentSet._changed then
+					-- The journal can only describe changes since the file
+					-- was saved.
+					suspended = true
+					NonmodalMessage("The journal will start once the document set has been saved.")
+				elseif not basehash then
+					basehash = filehash(documentSet.name)
+				end
+			end
+			return true
+		end
+	end
+
+	return false
+end
@@ -127,7 +127,7 @@ local function convert_clipboard()
 				newwords[#newwords+1] = w
 			end
 
-			doc[pn] = CreateParagraph(para.style, newwords)
+			doc:setParagraph(pn, CreateParagraph(para.style, newwords))
 		end
 	end
 
@@ -157,7 +157,7 @@ local function unconvert_clipboard()
 				newwords[#newwords+1] = w
 			end
 
-			clipboard[pn] = CreateParagraph(para.style, newwords)
+			clipboard:setParagraph(pn, CreateParagraph(para.style, newwords))
 		end
 	end
 
@@ -39,7 +39,9 @@ end
 
 -----------------------------------------------------------------------------
 -- Allow the spellchecker to be temporarily disabled (so we don't end up
--- spellchecking dialogue boxes, etc).
+-- spellchecking dialogue boxes, etc). Anything drawn while it's disabled
+-- has its decorations cached without highlighting, so this should only be
+-- used for text which isn't in a document.
 
 function SpellcheckerOff()
 	local settings = documentSet.addons.spellchecker or {}
@@ -69,25 +71,32 @@ local function get_user_dictionary_document(): Document
 		NonmodalMessage("Creating dictionary in document '"
 				..USER_DICTIONARY_NAME.."'.")
 
-		d[1] = CreateParagraph(
+		d:setParagraph(1, CreateParagraph(
 				"P",
 				SplitString("This is your user dictionary --- place words, "
 						.. "one at a time, in V paragraphs and they will be "
 						.. "considered valid in your document.", "%s")
-			)
-
-		AddEventListener("DocumentModified",
-			function(self, token, document)
-				if (document == d) then
-					user_dictionary_cache = nil
-				end
-			end
-		)
+			))
 	end
 	assert(d)
+
+	-- A dictionary loaded from a file is lazy; its words must be present
+	-- before it's read or edited.
+	d:materialise()
 	return d
 end
 
+-- Registered once rather than when the dictionary is created, so that a
+-- dictionary loaded from a file also refreshes the cache when edited.
+AddEventListener("DocumentModified",
+	function(self, token, document)
+		if (document.name == USER_DICTIONARY_NAME) then
+			user_dictionary_cache = nil
+			InvalidateDecorations()
+		end
+	end
+)
+
 function GetUserDictionary(): {[string]: string}
 	if not user_dictionary_cache then
 		local d = get_user_dictionary_document()
@@ -110,6 +119,7 @@ function GetSystemDictionary(): {[string]: string}
 	if not system_dictionary_cache then
 		local c = {}
 		system_dictionary_cache = c
+		InvalidateDecorations()
 
 		if settings.filename then
 			NonmodalMessage("Loading system dictionary '"
@@ -134,6 +144,7 @@ end
 function SetSystemDictionaryForTesting(array)
 	local c = {}
 	system_dictionary_cache = c
+	InvalidateDecorations()
 
 	for _, w in ipairs(array) do
 		c[w] = w
@@ -185,6 +196,7 @@ function Cmd.AddToUserDictionary()
 			d:appendParagraph(CreateParagraph("V", word))
 			documentSet:touch()
 			user_dictionary_cache = nil
+			InvalidateDecorations()
 			NonmodalMessage("Word '"..word.."' added to user dictionary")
 		else
 			NonmodalMessage("Word '"..word.."' already in user dictionary")
@@ -198,17 +210,28 @@ function Cmd.AddToUserDictionary()
 end
 
 -----------------------------------------------------------------------------
--- The core of the live checker: looks up a word and determines whether
--- it's misspelt or not.
+-- The core of the live checker: dims the misspelt words of a paragraph.
 
 do
+	local DIM = wg.DIM
+
 	local function cb(self, token, payload)
-		if IsWordMisspelt(payload.word, payload.firstword) then
-			payload.cstyle = bit32.bor(payload.cstyle, wg.DIM)
+		local settings = documentSet.addons.spellchecker or {}
+		if not settings.enabled then
+			return
+		end
+
+		local paragraph = payload.paragraph
+		local sentences = payload.sentences
+		local decorations = payload.decorations
+		for wn, word in paragraph do
+			if IsWordMisspelt(word, sentences[wn]) then
+				decorations[wn] = bit32.bor(decorations[wn] or 0, DIM)
+			end
 		end
 	end
 
-	AddEventListener("DrawWord", cb)
+	AddEventListener("DecorateParagraph", cb)
 end
 
 -----------------------------------------------------------------------------
@@ -359,6 +382,7 @@ function Cmd.ConfigureSpellchecker()
 	settings.usesystemdictionary = systemdictionary_checkbox.value
 	system_dictionary_cache = nil
 	settings.useuserdictionary = userdictionary_checkbox.value
+	InvalidateDecorations()
 	documentSet:touch()
 	return true
 end
@@ -378,6 +402,7 @@ function Cmd.ConfigureSystemDictionary()
 
 	if filename then
 		system_dictionary_cache = nil
+		InvalidateDecorations()
 		settings.filename = filename
 		SaveGlobalSettings()
 	end
@@ -4,92 +4,246 @@
 -- file in this distribution for the full text.
 
 local STACKSIZE = 500
+local MEMORYBUDGET = 32 * 1024 * 1024
 
-local function shallowequals(t1, t2)
-	if (#t1 ~= #t2) then
-		return false
-	end
+-- Rough sizes of the things which make up an undo entry, used to estimate
+-- how much memory the undo history is using.
+local OPBYTES = 64
+local PARAGRAPHBYTES = 64
+local WORDBYTES = 24
+
+-- Undo is done by journalling: once a document has an undo stack, every
+-- change made to its paragraphs is recorded in its journal (see
+-- document.lua) along with what's needed to reverse it. A checkpoint just
+-- files the journal away, so it costs in proportion to what changed, not to
+-- the size of the document.
+--
+-- Each entry on the undo stack is a state the document can be returned to.
+-- The ops of the top entry, applied after those in the journal, return the
+-- current document to that state; the ops of each lower entry then go back
+-- one step further. Redo entries work the same way in the other direction.
+--
+-- Each stack keeps an estimate of the memory its entries use, and forgets
+-- its oldest entries when they go over MEMORYBUDGET. (Paragraphs are often
+-- shared between entries, so this is an overestimate.)
+
+-----------------------------------------------------------------------------
+-- A fixed-size stack which forgets its oldest entries when it overflows.
+
+local UndoStack = {}
+UndoStack.__index = UndoStack
+UndoStack.__len = function(self: UndoStack)
+	return self.count
+end
 
-	for i = 1, #t1 do
-		if (t1[i] ~= t2[i]) then
-			return false
+local function CreateUndoStack(): UndoStack
+	local s = {
+		entries = {},
+		head = 0,
+		count = 0,
+		bytes = 0,
+	}
+	return (setmetatable(s, UndoStack)::any) :: UndoStack
+end
+
+local function opsbytes(ops: {UndoOp}): number
+	local bytes = 0
+	for _, op in ops do
+		bytes = bytes + OPBYTES
+		local p = op.paragraph
+		if p then
+			bytes = bytes + PARAGRAPHBYTES
+			for _, w in p do
+				bytes = bytes + WORDBYTES + #w
+			end
 		end
 	end
+	return bytes
+end
 
-	return true
+-- Forgets the oldest entry.
+function UndoStack.drop(self: UndoStack)
+	local i = ((self.head - self.count) % STACKSIZE) + 1
+	self.bytes = self.bytes - self.entries[i].bytes
+	self.entries[i] = nil
+	self.count = self.count - 1
 end
 
-local function shallowcopy(t1: Document): ShadowDocument
-	local t2  = {}
-	for k, v in ipairs(t1) do
-		t2[k] = v
+function UndoStack.push(self: UndoStack, entry: UndoEntry)
+	if self.count == STACKSIZE then
+		self:drop()
+	end
+	self.head = (self.head % STACKSIZE) + 1
+	self.entries[self.head] = entry
+	self.count = self.count + 1
+	self.bytes = self.bytes + entry.bytes
+
+	while (self.bytes > MEMORYBUDGET) and (self.count > 1) do
+		self:drop()
 	end
-	t2.cp, t2.cw, t2.co = t1.cp, t1.cw, t1.co
-	return t2
 end
 
-local function savedocument(): ShadowDocument
-	return shallowcopy(currentDocument)
+function UndoStack.pop(self: UndoStack): UndoEntry?
+	if self.count == 0 then
+		return nil
+	end
+
+	local entry = self.entries[self.head]
+	self.entries[self.head] = nil
+	self.head = ((self.head - 2) % STACKSIZE) + 1
+	self.count = self.count - 1
+	self.bytes = self.bytes - entry.bytes
+	return entry
 end
 
-local function loaddocument(copy: ShadowDocument)
-	local oldlen = #currentDocument
-	for i = 1, #copy do
-		currentDocument[i] = copy[i]
+-- Adds ops to the top entry, to be undone before the ones already there.
+function UndoStack.extend(self: UndoStack, ops: {UndoOp})
+	if (self.count == 0) or (#ops == 0) then
+		return
 	end
-	for i = #copy+1, oldlen do
-		currentDocument[i] = nil
+	local top = self.entries[self.head]
+
+	table.move(ops, 1, #ops, #top.ops + 1, top.ops)
+	local bytes = opsbytes(ops)
+	top.bytes = top.bytes + bytes
+	self.bytes = self.bytes + bytes
+
+	while (self.bytes > MEMORYBUDGET) and (self.count > 1) do
+		self:drop()
+	end
+end
+
+function UndoStack.top(self: UndoStack): UndoEntry?
+	if self.count == 0 then
+		return nil
+	end
+	return self.entries[self.head]
+end
+
+-----------------------------------------------------------------------------
+-- Reverses a list of journalled changes.
+
+local function revert(ops: {UndoOp})
+	for i = #ops, 1, -1 do
+		local op = ops[i]
+		if op.kind == "changed" then
+			currentDocument:setParagraph(op.pn, assert(op.paragraph))
+		elseif op.kind == "inserted" then
+			currentDocument:deleteParagraphAt(op.pn)
+		else
+			currentDocument:insertParagraphBefore(assert(op.paragraph), op.pn)
+		end
 	end
-	currentDocument.cp, currentDocument.cw, currentDocument.co = copy.cp, copy.cw, copy.co
-	currentDocument.mp = nil
-	QueueRedraw()
 end
 
-local function movechange(srcstack: {ShadowDocument},
-		deststack: {ShadowDocument})
-	local top = srcstack[1]
+local function movechange(srcstack: UndoStack, deststack: UndoStack)
+	local top = srcstack:pop()
 	if not top then
 		return false
 	end
-	table.remove(srcstack, 1)
 
-	table.insert(deststack, 1, savedocument())
+	-- Anything done since the last checkpoint is lost from the source stack,
+	-- so the destination stack must undo it too (as Cmd.Checkpoint() does).
+
+	local ops = currentDocument._journal or {}
+	deststack:extend(ops)
+
+	-- Reversing the changes journals them, giving the ops which go back to
+	-- where we are now.
+
+	local cp, cw, co = currentDocument.cp, currentDocument.cw, currentDocument.co
+	currentDocument._journal = {}
+	revert(ops)
+	revert(top.ops)
+
+	ops = currentDocument._journal
+	deststack:push({ ops = ops, bytes = opsbytes(ops), cp = cp, cw = cw, co = co })
+	currentDocument._journal = {}
 
-	loaddocument(top)
+	currentDocument.cp, currentDocument.cw, currentDocument.co = top.cp, top.cw, top.co
+	currentDocument.mp = nil
+	FreezeParagraphs()
+	QueueRedraw()
 	return true
 end
 
 -----------------------------------------------------------------------------
 -- Commit an undo checkpoint
 
-function Cmd.Checkpoint()
-	local undostack: {ShadowDocument} = currentDocument._undostack or {}
+local function checkpoint(typing: boolean)
+	local undostack: UndoStack = currentDocument._undostack or CreateUndoStack()
 	currentDocument._undostack = undostack
 
-	local top = undostack[1]
-	if not top or not shallowequals(currentDocument, top) then
-		local copy = savedocument()
-		table.insert(undostack, 1, copy)
-		undostack[STACKSIZE] = nil
+	local cp, cw, co = currentDocument.cp, currentDocument.cw, currentDocument.co
+	local top = undostack:top()
+	local ops = currentDocument._journal or {}
+
+	-- Successive keystrokes typed into the same word are undone together.
+	-- The new characters go into the same journal, which also means the
+	-- paragraph can carry on being modified in place.
+	if typing and top and top.typing and (#top.ops == 0) then
+		local t = top.typing
+		local coalesce = (t.cp == cp) and (t.cw == cw) and (t.co < co)
+		for _, op in ops do
+			if (op.kind ~= "changed") or (op.pn ~= cp) then
+				coalesce = false
+				break
+			end
+		end
+		if coalesce then
+			top.typing = { cp = cp, cw = cw, co = co }
+			return true
+		end
+	end
+
+	if not top or (#ops > 0) or (#top.ops > 0) then
+		-- The top entry must now also undo everything in the journal.
+		undostack:extend(ops)
+
+		undostack:push({
+			ops = {},
+			bytes = 0,
+			cp = cp,
+			cw = cw,
+			co = co,
+			typing = typing and { cp = cp, cw = cw, co = co } or nil,
+		})
+		currentDocument._journal = {}
 
 		-- Nuke the redo stack.
-		currentDocument._redostack = {}
+		currentDocument._redostack = CreateUndoStack()
+
+		-- The journal refers to paragraphs in the document, so they mustn't
+		-- be modified in place from now on.
+		FreezeParagraphs()
 	end
-	
+
 	return true
 end
 
+function Cmd.Checkpoint()
+	return checkpoint(false)
+end
+
+-- As Cmd.Checkpoint(), but before typing a character.
+function Cmd.CheckpointTyping()
+	return checkpoint(true)
+end
+
 -----------------------------------------------------------------------------
 -- Undo a change.
 
 function Cmd.Undo()
-	local undostack = currentDocument._undostack or {}
-	local redostack = currentDocument._redostack or {}
+	local undostack: UndoStack = currentDocument._undostack or CreateUndoStack()
+	local redostack: UndoStack = currentDocument._redostack or CreateUndoStack()
+	currentDocument._undostack = undostack
+	currentDocument._redostack = redostack
 	if not movechange(undostack, redostack) then
 		NonmodalMessage("Nothing left to undo")
 		return false
 	end
-	NonmodalMessage("Undone ("..#undostack.." left in undo buffer)")
+	NonmodalMessage(string.format("Undone (%d left in undo buffer, %d kB)",
+		#undostack, math.ceil(undostack.bytes / 1024)))
 	return true
 end
 
@@ -97,13 +251,16 @@ end
 -- Redo an undone change.
 
 function Cmd.Redo()
-	local undostack: {ShadowDocument} = currentDocument._undostack or {}
-	local redostack: {ShadowDocument} = currentDocument._redostack or {}
+	local undostack: UndoStack = currentDocument._undostack or CreateUndoStack()
+	local redostack: UndoStack = currentDocument._redostack or CreateUndoStack()
+	currentDocument._undostack = undostack
+	currentDocument._redostack = redostack
 	if not movechange(redostack, undostack) then
 		NonmodalMessage("Nothing left to redo")
 		return false
 	end
-	NonmodalMessage("Redone ("..#redostack.." left in redo buffer)")
+	NonmodalMessage(string.format("Redone (%d left in redo buffer, %d kB)",
+		#redostack, math.ceil(redostack.bytes / 1024)))
 	return true
 end
 
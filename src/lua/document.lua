@@ -16,6 +16,7 @@ local SetDim = wg.setdim
 local GetStringWidth = wg.getstringwidth
 local GetBytesOfCharacter = wg.getbytesofcharacter
 local GetWordText = wg.getwordtext
+local LoadTextParagraphs = wg.loadtextparagraphs
 local BOLD = wg.BOLD
 local ITALIC = wg.ITALIC
 local UNDERLINE = wg.UNDERLINE
@@ -39,17 +40,70 @@ type DocumentStyle = {
 type DocumentStyles = {[number | string]: DocumentStyle}
 documentStyles = {} :: DocumentStyles
 
+-- Bumped whenever documentStyles changes, as paragraph spacing depends on it.
+local stylesgeneration = 0
+
 local Document = {}
 Document.__index = Document
 _G.Document = Document
 declare currentDocument: Document
 
-type ShadowDocument = {
-	[number]: Paragraph,
+-- Records a change to one paragraph of a document. pn is the paragraph's
+-- index at the time of the change, so the entries of a change log must be
+-- applied in order.
+type ChangeKind = "changed" | "inserted" | "deleted"
+type DocumentChange = {
+	kind: ChangeKind,
+	pn: number,
+}
+
+-- All changes since the last Changed event. If all is set, the document
+-- should be treated as completely changed and the entries are meaningless.
+type ChangeLog = {
+	[number]: DocumentChange,
+	all: boolean?,
+}
+
+-- Records how to reverse a change to one paragraph of a document: the kind
+-- of change that was made, and the paragraph which was replaced or deleted.
+type UndoOp = {
+	kind: ChangeKind,
+	pn: number,
+	paragraph: Paragraph?,
+}
+
+-- An undo or redo step. ops are applied last to first, and the cursor is
+-- then restored.
+type UndoEntry = {
+	ops: {UndoOp},
+	bytes: number, -- estimated memory used by ops
+	typing: {cp: number, cw: number, co: number}?, -- see Cmd.CheckpointTyping
 
 	cp: number,
 	cw: number,
-	co: number
+	co: number,
+}
+
+type UndoStack = {
+	entries: {UndoEntry},
+	head: number,
+	count: number,
+	bytes: number,
+
+	push: (self: UndoStack, entry: UndoEntry) -> (),
+	pop: (self: UndoStack) -> UndoEntry?,
+	top: (self: UndoStack) -> UndoEntry?,
+	extend: (self: UndoStack, ops: {UndoOp}) -> (),
+	drop: (self: UndoStack) -> (),
+}
+
+-- Where each paragraph is on the screen (see getlineindex()).
+type LineIndex = {
+	width: number,
+	styles: number, -- stylesgeneration the heights were measured with
+	heights: {number | false}, -- of each paragraph, or false if unknown
+	tree: {number}?, -- Fenwick tree of heights; nil if it needs rebuilding
+	pending: {number}, -- paragraphs whose heights in tree may be wrong
 }
 
 type Document = {
@@ -67,9 +121,10 @@ type Document = {
 	redostack: nil,
 
 	-- Transient data, not stored in files.
-	_changed: boolean,
-	_undostack: {ShadowDocument}?,
-	_redostack: {ShadowDocument}?,
+	_changed: boolean, -- the paragraphs have changed since _source was made
+	_undostack: UndoStack?,
+	_redostack: UndoStack?,
+	_journal: {UndoOp}?, -- changes since the last undo checkpoint
 	_wrapwidth: number?,
 	_topp: number?, -- paragraph number of top of screen
 	_topw: number?, -- word number of top of screen
@@ -77,6 +132,17 @@ type Document = {
 	_botw: number?, -- word number of bottom of screen
 	_sp: number?, -- redraw point on screen, paragraph
 	_sw: number?, -- redraw point on screen, word
+	_counted: boolean?, -- wordcount and paragraph numbers are up to date
+	_renumberfrom: number?, -- first paragraph whose number may be wrong
+	_renumberto: number?, -- last paragraph whose number may be wrong
+	_changes: ChangeLog?, -- changes since the last Changed event
+	_source: Source?, -- the paragraphs as they were last loaded or saved
+	_sourceoffset: number?, -- where they start in _source
+	_sourceend: number?, -- where they end in _source
+	_unloaded: boolean?, -- the paragraphs are still only in _source
+	_loadedfirst: number?, -- first paragraph loaded from a partial document
+	_loadedlast: number?, -- last paragraph loaded from a partial document
+	_lineindex: LineIndex?, -- built on demand by getlineindex()
 
 	cp: number,
 	cw: number,
@@ -89,6 +155,7 @@ type Document = {
 
 	cursor: (self: Document) -> {number},
 	appendParagraph: (self: Document, p: Paragraph) -> (),
+	setParagraph: (self: Document, pn: number, p: Paragraph) -> (),
 	insertParagraphBefore: (self: Document, paragraph: Paragraph, pn: number)
 		-> (),
 	deleteParagraphAt: (self: Document, pn: number) -> (),
@@ -99,28 +166,396 @@ type Document = {
 	spaceAbove: (self: Document, pn: number) -> number,
 	spaceBelow: (self: Document, pn: number) -> number,
 	renumber: (self: Document) -> (),
+	invalidateCounts: (self: Document) -> (),
+	takeChanges: (self: Document) -> ChangeLog,
+	materialise: (self: Document, pn: number?) -> Document,
+	isPartial: (self: Document) -> boolean,
+	getLineOfParagraph: (self: Document, pn: number) -> number,
+	getParagraphAtLine: (self: Document, line: number) -> (number, number),
+	getHeight: (self: Document) -> number,
 }
 
 function Document.cursor(self: Document)
 	return { self.cp, self.cw, self.co }
 end
 
+-- The word count and list numbers are maintained incrementally: each
+-- paragraph remembers how many words it had when it was last counted (in
+-- _wordcount, which survives in-place modification), and the range of
+-- paragraphs whose numbers may have changed is recorded for renumber() to
+-- fix up. All changes to the paragraphs of a document should go through the
+-- methods below; anything else must call invalidateCounts().
+--
+-- The same methods also record each change in the document's change log,
+-- which is handed to listeners of the Changed event so that they can update
+-- only the affected paragraphs, and (once the undo system has started one)
+-- in the journal from which undo steps are made.
+
+local MAXCHANGES = 256
+
+local function markdirty(self: Document, first: number, last: number)
+	local from = self._renumberfrom
+	local to = self._renumberto
+	if from and to then
+		self._renumberfrom = math.min(from, first)
+		self._renumberto = math.max(to, last)
+	else
+		self._renumberfrom = first
+		self._renumberto = last
+	end
+end
+
+local function logchange(self: Document, kind: ChangeKind, pn: number)
+	self._changed = true
+
+	local log = self._changes
+	if not log then
+		log = {}
+		self._changes = log
+	end
+	if log.all then
+		return
+	end
+
+	-- Repeated changes to the same paragraph (i.e. typing) only need logging
+	-- once.
+	local last = log[#log]
+	if last and (kind == "changed") and (last.pn == pn)
+			and (last.kind ~= "deleted") then
+		return
+	end
+
+	-- Past a certain point it's cheaper for listeners to start again.
+	if #log == MAXCHANGES then
+		self._changes = { all = true }
+		return
+	end
+
+	log[#log+1] = { kind = kind, pn = pn }
+end
+
+local function journal(self: Document, kind: ChangeKind, pn: number,
+		paragraph: Paragraph?)
+	local j = self._journal
+	if j then
+		j[#j+1] = { kind = kind, pn = pn, paragraph = paragraph }
+	end
+end
+
+-- Keeps the line index (see getLineOfParagraph()) up to date. Changing a
+-- paragraph just queues it to be remeasured; inserting or deleting one
+-- shifts the heights of the rest, so the tree has to be rebuilt (which
+-- doesn't involve rewrapping anything).
+local function updatelineindex(self: Document, kind: ChangeKind, pn: number)
+	local index = self._lineindex
+	if not index then
+		return
+	end
+
+	-- A paragraph's height includes the space below it, which depends on
+	-- the paragraph after it.
+	local pending = index.pending
+	pending[#pending+1] = pn
+	if pn > 1 then
+		pending[#pending+1] = pn - 1
+	end
+	if (kind == "changed") and index.tree then
+		return
+	end
+
+	-- Paragraph numbers are about to change (or the tree's being rebuilt
+	-- anyway), so the queued paragraphs are just marked as unknown.
+	local heights = index.heights
+	for _, ppn in pending do
+		if heights[ppn] ~= nil then
+			heights[ppn] = false
+		end
+	end
+	index.pending = {}
+	if kind == "changed" then
+		return
+	end
+
+	index.tree = nil
+	if kind == "inserted" then
+		table_insert(heights, pn, false)
+	else
+		table_remove(heights, pn)
+	end
+end
+
+local function uncount(p: Paragraph): number
+	return p._wordcount or #p
+end
+
 function Document.appendParagraph(self: Document, p)
-	self[#self+1] = p
+	self:materialise()
+	local pn = #self+1
+	self[pn] = p
+	logchange(self, "inserted", pn)
+	journal(self, "inserted", pn)
+	updatelineindex(self, "inserted", pn)
+	if self._counted then
+		self.wordcount = self.wordcount + #p
+		p._wordcount = #p
+		markdirty(self, pn, pn)
+	end
+end
+
+-- Replaces (or re-stores, after in-place modification) paragraph pn.
+function Document.setParagraph(self: Document, pn: number, p: Paragraph)
+	self:materialise()
+	local old = self[pn]
+	self[pn] = p
+	logchange(self, "changed", pn)
+	updatelineindex(self, "changed", pn)
+
+	-- A paragraph modified in place must have been put here since the
+	-- journal was started (see FreezeParagraphs()), so the journal can
+	-- already restore what was here before.
+	if p ~= old then
+		journal(self, "changed", pn, old)
+	end
+	if self._counted then
+		self.wordcount = self.wordcount - uncount(old) + #p
+		p._wordcount = #p
+		if (p ~= old) and (p.style == old.style) then
+			p.number = old.number
+		elseif p ~= old then
+			markdirty(self, pn, pn)
+		end
+	end
 end
 
 function Document.insertParagraphBefore(self: Document, paragraph, pn)
+	self:materialise()
 	table.insert(self, pn, paragraph)
+	logchange(self, "inserted", pn)
+	journal(self, "inserted", pn)
+	updatelineindex(self, "inserted", pn)
+	if self._counted then
+		self.wordcount = self.wordcount + #paragraph
+		paragraph._wordcount = #paragraph
+		local to = self._renumberto
+		if to and (to >= pn) then
+			self._renumberto = to + 1
+		end
+		markdirty(self, pn, pn)
+	end
 end
 
 function Document.deleteParagraphAt(self: Document, pn)
-	table.remove(self, pn)
+	self:materialise()
+	local p = table.remove(self, pn)
+	logchange(self, "deleted", pn)
+	journal(self, "deleted", pn, p)
+	updatelineindex(self, "deleted", pn)
+	if self._counted then
+		self.wordcount = self.wordcount - uncount(p)
+		local to = self._renumberto
+		if to and (to > pn) then
+			self._renumberto = to - 1
+		end
+		markdirty(self, pn, pn)
+	end
+end
+
+-- Forces the next renumber() to recount the whole document (and the line
+-- index to be rebuilt), and reports the whole document as changed.
+function Document.invalidateCounts(self: Document)
+	self._counted = false
+	self._renumberfrom = nil
+	self._renumberto = nil
+	self._changes = { all = true }
+	self._changed = true
+	self._lineindex = nil
+end
+
+-- Documents in a loaded document set don't have their paragraphs parsed
+-- until something needs them (see loadfromstringt() in fileio.lua). This
+-- must be called before looking at the paragraphs of any document other
+-- than the current one. Returns self.
+--
+-- If pn is given and the document is big, only the paragraphs around pn are
+-- loaded, so that they can be shown quickly; the rest are set to a
+-- placeholder and loaded by the next call without pn (which the event loop
+-- makes before handling any input).
+local PROGRESSIVEBYTES = 1024 * 1024
+local PROGRESSIVEWINDOW = 200
+
+function Document.materialise(self: Document, pn: number?): Document
+	if not self._unloaded then
+		return self
+	end
+	local source = assert(self._source)
+	local offset = assert(self._sourceoffset)
+
+	-- Loading isn't a change, so _source can still be used for saving.
+	local changed = self._changed
+
+	local first = self._loadedfirst
+	local last = self._loadedlast
+	if first and last then
+		LoadTextParagraphs(source, offset, self, Paragraph, 1, first - 1)
+		LoadTextParagraphs(source, offset, self, Paragraph, last + 1, #self)
+	elseif pn and ((assert(self._sourceend) - offset) > PROGRESSIVEBYTES) then
+		first = math.max(pn - PROGRESSIVEWINDOW, 1)
+		last = pn + PROGRESSIVEWINDOW
+
+		-- Placeholders aren't stamped with a serial, so they're immutable.
+		local placeholder = setmetatable({ style = "P" }, Paragraph)
+		LoadTextParagraphs(source, offset, self, Paragraph, first, last,
+			placeholder)
+		self._loadedfirst = first
+		self._loadedlast = last
+		self:invalidateCounts()
+		self._changed = changed
+		return self
+	else
+		LoadTextParagraphs(source, offset, self, Paragraph)
+	end
+
+	self._unloaded = nil
+	self._loadedfirst = nil
+	self._loadedlast = nil
+	self:invalidateCounts()
+	self._changed = changed
+	return self
+end
+
+-- Returns true if only some of the document's paragraphs have been loaded.
+function Document.isPartial(self: Document): boolean
+	return self._loadedfirst ~= nil
+end
+
+-- Returns the changes made since the last call, and starts a new log.
+function Document.takeChanges(self: Document): ChangeLog
+	local log = self._changes or {}
+	self._changes = nil
+	return log
 end
 
 function Document.wrap(self: Document, width: number)
 	self._wrapwidth = width
 end
 
+-----------------------------------------------------------------------------
+-- The line index records the height on the screen of each paragraph (its
+-- wrapped lines plus the space below it) in a Fenwick tree, so that the
+-- line a paragraph starts on, and the paragraph on a given line, can be
+-- found in logarithmic time. It's built the first time it's needed, which
+-- wraps the whole document, and then kept up to date by the methods which
+-- change paragraphs; changing the wrap width starts it again.
+
+local function lowbit(i: number): number
+	return bit32.band(i, -i)
+end
+
+local function measure(self: Document, pn: number, width: number): number
+	return #self[pn]:wrap(width).lines + self:spaceBelow(pn)
+end
+
+local function getlineindex(self: Document): LineIndex
+	local width = self._wrapwidth or 80
+	local n = #self
+	local index = self._lineindex
+	if not index or (index.width ~= width)
+			or (index.styles ~= stylesgeneration) or (#index.heights ~= n) then
+		index = {
+			width = width,
+			styles = stylesgeneration,
+			heights = table.create(n, false),
+			tree = nil,
+			pending = {},
+		}
+		self._lineindex = index
+	end
+	assert(index)
+
+	local heights = index.heights
+	local tree = index.tree
+	if not tree then
+		local t = table.create(n, 0)
+		for pn = 1, n do
+			local h = heights[pn]
+			if not h then
+				h = measure(self, pn, width)
+				heights[pn] = h
+			end
+			t[pn] = t[pn] + h
+			local parent = pn + lowbit(pn)
+			if parent <= n then
+				t[parent] = t[parent] + t[pn]
+			end
+		end
+		tree = t
+		index.tree = t
+		index.pending = {}
+	else
+		for _, pn in index.pending do
+			local old = heights[pn]
+			local new = measure(self, pn, width)
+			if new ~= old then
+				heights[pn] = new
+				local delta = new - old
+				local i = pn
+				while i <= n do
+					tree[i] = tree[i] + delta
+					i = i + lowbit(i)
+				end
+			end
+		end
+		index.pending = {}
+	end
+	return index
+end
+
+-- Returns the number of screen lines above paragraph pn.
+function Document.getLineOfParagraph(self: Document, pn: number): number
+	local tree = assert(getlineindex(self).tree)
+	local line = 0
+	local i = pn - 1
+	while i > 0 do
+		line = line + tree[i]
+		i = i - lowbit(i)
+	end
+	return line
+end
+
+-- Returns the paragraph which is on the given screen line (counting from
+-- 0), and which of its lines it is (counting from 1; this may be past its
+-- last line if the screen line is in the space below it). Lines past the end
+-- of the document are in the last paragraph.
+function Document.getParagraphAtLine(self: Document, line: number):
+		(number, number)
+	local index = getlineindex(self)
+	local tree = assert(index.tree)
+	local n = #self
+	local pn = 0
+	local step = 1
+	while (step * 2) <= n do
+		step = step * 2
+	end
+	while step > 0 do
+		local i = pn + step
+		if (i <= n) and (tree[i] <= line) then
+			pn = i
+			line = line - tree[i]
+		end
+		step = math.floor(step / 2)
+	end
+
+	if pn == n then
+		return n, line + 1 + (index.heights[n] :: number)
+	end
+	return pn + 1, line + 1
+end
+
+-- Returns the number of screen lines in the whole document.
+function Document.getHeight(self: Document): number
+	return self:getLineOfParagraph(#self + 1)
+end
+
 function Document.getMarks(self: Document)
 	if not self.mp then
 		return
@@ -184,22 +619,77 @@ function Document.touch(self: Document)
 end
 
 function Document.renumber(self: Document)
-	local wc = 0
-	local pn = 1
+	-- Counting a partly loaded document would be wasted work; it'll be
+	-- counted once it's all there.
+	if self:isPartial() then
+		return
+	end
 
-	for _, p in ipairs(self) do
-		wc = wc + #p
+	if not self._counted then
+		local wc = 0
+		local pn = 1
 
-		local style = documentStyles[p.style]
+		for _, p in ipairs(self) do
+			wc = wc + #p
+			p._wordcount = #p
+
+			local style = documentStyles[p.style]
+			if style.numbered then
+				p.number = pn
+				pn = pn + 1
+			elseif not style.list then
+				pn = 1
+			end
+		end
+
+		self.wordcount = wc
+		self._counted = true
+		self._renumberfrom = nil
+		self._renumberto = nil
+		return
+	end
+
+	local from = self._renumberfrom
+	local to = self._renumberto
+	if not from or not to then
+		return
+	end
+	self._renumberfrom = nil
+	self._renumberto = nil
+
+	-- Find the number the first dirty paragraph should continue from by
+	-- looking backwards through the list it's in (if any).
+
+	local n = 1
+	for i = from-1, 1, -1 do
+		local style = documentStyles[self[i].style]
 		if style.numbered then
-			p.number = pn
-			pn = pn + 1
+			n = self[i].number + 1
+			break
 		elseif not style.list then
-			pn = 1
+			break
 		end
 	end
 
-	self.wordcount = wc
+	-- Now renumber forwards until past the dirty range and the numbers stop
+	-- changing, or the list ends.
+
+	for i = from, #self do
+		local p = self[i]
+		local style = documentStyles[p.style]
+		if style.numbered then
+			if (i > to) and (p.number == n) then
+				break
+			end
+			p.number = n
+			n = n + 1
+		elseif not style.list then
+			if i > to then
+				break
+			end
+			n = 1
+		end
+	end
 end
 
 -- Returns how many screen spaces a portion of a string takes up.
@@ -360,6 +850,7 @@ function UpdateDocumentStyles()
 	end
 
 	documentStyles = styles
+	stylesgeneration = stylesgeneration + 1
 end
 
 function CreateDocument(): Document
@@ -156,6 +156,7 @@ DocumentSet.deleteDocument = function(self, name)
 
 	self:touch()
 	RebuildDocumentsMenu(self.documents)
+	FireEvent("DocumentDeleted", document)
 
 	if (currentDocument == document) then
 		document = self.documents[n]
@@ -173,7 +174,7 @@ DocumentSet.setCurrent = function(self, name)
 	-- Ensure any housekeeping on the current document gets done.
 
 	if currentDocument._changed then
-		FireEvent("Changed")
+		FireEvent("Changed", currentDocument:takeChanges())
 	end
 
 	currentDocument = self._documentIndex[name]
@@ -182,6 +183,7 @@ DocumentSet.setCurrent = function(self, name)
 	end
 
 	self.current = currentDocument
+	currentDocument:materialise()
 	currentDocument:renumber()
 	ResizeScreen()
 end
@@ -198,6 +200,7 @@ DocumentSet.renameDocument = function(self, oldname, newname)
 
 	self:touch()
 	RebuildDocumentsMenu(self.documents)
+	FireEvent("DocumentRenamed", d, oldname)
 	return true
 end
 
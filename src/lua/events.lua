@@ -11,12 +11,18 @@ local batched = {} :: {[Event]: boolean}
 
 type Event =
 	  "BuildStatusBar"    --- (statusbararray) the contents of the statusbar is being calculated
-	| "Changed"           --- the document's been changed
+	| "Autosaved"         --- (filename) an autosave has just finished
+	| "Changed"           --- (changes) the document's been changed
+	| "DecorateParagraph" --- (paragraph=, sentences=, decorations=) the words of a paragraph are being decorated
 	| "DocumentCreated"   --- a new documentset has just been created
+	| "DocumentDeleted"   --- (document) a document has been removed from the documentset
 	| "DocumentLoaded"    --- a new documentset has just been loaded
 	| "DocumentModified"  --- (document) a document has been modified
+	| "DocumentRenamed"   --- (document, oldname) a document has been renamed
+	| "DocumentSaved"     --- the documentset has just been saved
 	| "DocumentUpgrade"   --- (oldversion, newversion) the documentset is being upgraded
-	| "DrawWord"          --- (word=, ostyle=, cstyle=) a word is being drawn on the screen
+	| "DrawWord"          --- (word=, cstyle=, firstword=) deprecated: use DecorateParagraph
+	| "Exit"              --- the program is about to exit
 	| "KeyTyped"          --- (value=) user is typing into the document
 	| "Idle"              --- the user isn't touching the keyboard
 	| "Moved"             --- the cursor has moved
@@ -62,6 +68,16 @@ function RemoveEventListener(token: EventToken)
 	listeners[event][token] = nil
 end
 
+--- Checks whether an event has any listeners.
+--
+-- @param event              the event to check
+-- @return                   true if anything is listening for it
+
+function HasEventListeners(event: Event): boolean
+	local l = listeners[event]
+	return (l ~= nil) and (next(l) ~= nil)
+end
+
 --- Fires an event.
 -- Any callbacks registered for the event will be called (in any order).
 --
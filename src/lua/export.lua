@@ -190,16 +190,17 @@ function ExportFileWithUI(filename, title, extension, callback)
 
 	ImmediateMessage("Exporting "..filename.."...")
 
-        local data: {string} = {}
-        local writer = function(...: string)
-                for _, s in ipairs({...}) do
-                        data[#data+1] = s
-                end
-        end
+	local data: {string} = {}
+	local writer = function(...: string)
+		for _, s in ipairs({...}) do
+			data[#data+1] = s
+		end
+	end
 
-        callback(writer, currentDocument)
+	callback(writer, currentDocument)
 
-	local _, e = WriteFile(filename, table.concat(data))
+	-- The fragments are written as they are, without being joined first.
+	local _, e = WriteFile(filename, data)
 	if e then
 		ModalMessage(nil, "Unable to open the output file "..e..".")
 		QueueRedraw()
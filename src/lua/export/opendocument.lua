@@ -360,7 +360,7 @@ local function export_odt_with_ui(filename, title, extension)
 				xmlns:office="urn:oasis:names:tc:opendocument:xmlns:office:1.0"/>
 		]],
 		
-		["content.xml"] = table.concat(content)
+		["content.xml"] = content
 	}
 	
 	if not writezip(filename, xml) then
@@ -4,7 +4,7 @@
 -- file in this distribution for the full text.
 
 local ParseWord = wg.parseword
-local WriteFile = wg.writefile
+local OpenFile = wg.openfile
 local bitand = bit32.band
 local bitor = bit32.bor
 local bitxor = bit32.bxor
@@ -12,16 +12,26 @@ local bit = bit32.btest
 local time = wg.time
 local compress = wg.compress
 local decompress = wg.decompress
+local MapFile = wg.mapfile
+local CreateCompressor = wg.createcompressor
 local writeu8 = wg.writeu8
 local readu8 = wg.readu8
 local escape = wg.escape
-local unescape = wg.unescape
+local LoadTextDumpfile = wg.loadtextdumpfile
+local LoadBinaryDump = wg.loadbinarydump
+local WriteBinaryDumpfile = wg.writebinarydumpfile
 local string_format = string.format
 local unpack = rawget(_G, "unpack") or table.unpack
 
 local MAGIC = "WordGrinder dumpfile v1: this is not a text file!"
 local ZMAGIC = "WordGrinder dumpfile v2: this is not a text file!"
 local TMAGIC = "WordGrinder dumpfile v3: this is a text file; diff me!"
+local BMAGIC = "WordGrinder dumpfile v4: this is not a text file!"
+local GZMAGIC = "\31\139"
+
+-- Document sets whose filenames end in .gz are saved gzipped (always in the
+-- text format), at this compression level.
+local GZIPLEVEL = 6
 
 local STOP = 0
 local TABLE = 1
@@ -39,12 +49,33 @@ local PARAGRAPHCLASS = 102
 local WORDCLASS = 103
 local MENUCLASS = 104
 
-local function writetostreamt(object, write)
+-- Where a document's paragraphs were written, as byte offsets into the
+-- output (counting from 1); last is where the terminating '.' line starts.
+type SavedDocument = {
+	document: Document,
+	first: number,
+	last: number,
+}
+
+-- write may be passed any number of strings, and should write them
+-- consecutively. If noparagraphs is set, the documents' paragraphs are left
+-- out (as they are from the metadata of a binary dumpfile). Returns where
+-- each document's paragraphs went.
+local function writetostreamt(object, write: (...string) -> (),
+		noparagraphs: boolean?): {SavedDocument}
+	local pos = 1
+	local rawwrite = write
+	write = function(...)
+		for i = 1, select("#", ...) do
+			pos = pos + #(select(i, ...))
+		end
+		rawwrite(...)
+	end
+
+	local saved: {SavedDocument} = {}
+
 	local writeo = function(k, v)
-		write(k)
-		write(": ")
-		write(v)
-		write("\n")
+		write(k, ": ", v, "\n")
 	end
 
 	local function save(key: string, t: any)
@@ -83,23 +114,32 @@ local function writetostreamt(object, write)
 	end
 
 	local function save_document(i, d)
-		write("#")
-		write(tostring(i))
-		write("\n")
-
-		for _, p in ipairs(d) do
-			write(p.style)
-
-			for _, s in ipairs(p) do
-				write(" ")
-				write(s)
+		write("#", tostring(i), "\n")
+		local first = pos
+
+		-- Documents which haven't changed since they were loaded or last
+		-- saved (including those which have never been loaded at all) are
+		-- copied from the text they were loaded or saved as, so saving costs
+		-- in proportion to what's changed.
+		local source = d._source
+		if source and (d._unloaded or not d._changed) then
+			local s = source:sub(d._sourceoffset, d._sourceend - 1)
+			write(s)
+			if (s ~= "") and (s:sub(-1) ~= "\n") then
+				write("\n")
+			end
+		else
+			for _, p in ipairs(d) do
+				if #p == 0 then
+					write(p.style, "\n")
+				else
+					write(p.style, " ", table.concat(p, " "), "\n")
+				end
 			end
-
-			write("\n")
 		end
 
-		write(".")
-		write("\n")
+		saved[#saved+1] = { document = d, first = first, last = pos }
+		write(".\n")
 	end
 
 	save("", object)
@@ -110,36 +150,30 @@ local function writetostreamt(object, write)
 			save(".current", object:_findDocument(object.current.name))
 		end
 
-		for i, d in ipairs(object.documents) do
-			save_document(i, d)
+		if not noparagraphs then
+			for i, d in ipairs(object.documents) do
+				save_document(i, d)
+			end
 		end
 	end
 
-	return true
+	return saved
 end
 
-function SaveToHeaderlessString(object)
+function SaveToHeaderlessString(object, noparagraphs: boolean?)
 	local ss = {}
-	local write = function(s)
-		ss[#ss+1] = s
+	local write = function(...)
+		for _, s in {...} do
+			ss[#ss+1] = s
+		end
 	end
 
-	writetostreamt(object, write)
+	writetostreamt(object, write, noparagraphs)
 	return table.concat(ss)
 end
 
-function SaveToFile(filename: string, object: any): (boolean, string?)
-	-- Write the file to a *different* filename (so that crashes during
-	-- writing doesn't corrupt the file).
-
-	local s = TMAGIC .. "\n" .. SaveToHeaderlessString(object)
-
-	local new_filename = filename..".new"
-	local _, e = WriteFile(new_filename, s)
-	if e then
-		return false, e
-	end
-
+-- Replaces filename with new_filename, which has just been written.
+local function replacefile(new_filename: string, filename: string): (boolean, string?)
 	-- At this point, we know the new file has been written correctly.
 	-- We can remove the old one and rename the new one to be the old
 	-- one. On proper operating systems we could do this in a single
@@ -155,7 +189,89 @@ function SaveToFile(filename: string, object: any): (boolean, string?)
 	return r, e
 end
 
+function SaveToFile(filename: string, object: any): (boolean, string?)
+	-- Write the file to a *different* filename (so that crashes during
+	-- writing doesn't corrupt the file).
+
+	-- The file is written as it's generated, so there's never a copy of the
+	-- whole thing in memory.
+
+	local new_filename = filename..".new"
+	local fp, e = OpenFile(new_filename, "w")
+	if not fp then
+		return false, e
+	end
+
+	local write = function(...)
+		fp:write(...)
+	end
+
+	local compressor = nil
+	if filename:find("%.gz$") then
+		local c = CreateCompressor(GZIPLEVEL, true)
+		write = function(...)
+			fp:write(c:feed(...))
+		end
+		compressor = c
+	end
+
+	write(TMAGIC, "\n")
+	local saved = writetostreamt(object, write)
+	if compressor then
+		fp:write(compressor:finish())
+	end
+
+	local _, e = fp:close()
+	if e then
+		return false, e
+	end
+
+	local r, e = replacefile(new_filename, filename)
+	if e then
+		return r, e
+	end
+
+	-- Each document's text is now in the new file, so map it and copy from
+	-- there next time. (The text of a gzipped file can't be mapped; its
+	-- documents are re-encoded, unless they're still in what was loaded.)
+	local data = (#saved > 0) and not compressor and MapFile(filename)
+	for _, s in saved do
+		local d = s.document
+		if data then
+			d._source = data
+			d._sourceoffset = s.first + #TMAGIC + 1
+			d._sourceend = s.last + #TMAGIC + 1
+		elseif d._changed then
+			d._source = nil
+		end
+		d._changed = false
+	end
+	return r, e
+end
+
+-- As SaveToFile(), but writes a v4 binary dumpfile, which is much faster to
+-- load than a text one but can't be diffed or edited by hand.
+function SaveToBinaryFile(filename: string, documentset: DocumentSet): (boolean, string?)
+	-- Every paragraph is written, so they must all be loaded.
+	for _, d in documentset.documents do
+		d:materialise()
+	end
+
+	local new_filename = filename..".new"
+	local r, e = WriteBinaryDumpfile(new_filename,
+		SaveToHeaderlessString(documentset, true), documentset.documents)
+	if not r then
+		return false, e
+	end
+
+	return replacefile(new_filename, filename)
+end
+
 function SaveDocumentSetRaw(filename): (boolean?, string?)
+	local settings = documentSet.addons.fileformat
+	if settings and settings.binary and not filename:find("%.gz$") then
+		return SaveToBinaryFile(filename, documentSet)
+	end
 	return SaveToFile(filename, documentSet)
 end
 
@@ -182,6 +298,7 @@ function Cmd.SaveCurrentDocumentAs(filename: string?): boolean
 		ModalMessage("Save failed", "The document could not be saved: "..e)
 	else
 		NonmodalMessage("Save succeeded.")
+		FireEvent("DocumentSaved")
 	end
 	return assert(r)
 end
@@ -469,100 +586,28 @@ local function loadfromstreamz(fp): DocumentSet
 	return load()
 end
 
-local function loadfromstreamt(fp): DocumentSet
-	local data = CreateDocumentSet()
-	data.menu = CreateMenuTree()
-	data.documents = {}
+-- Once the screen is up, the event loop finishes loading partly loaded
+-- documents before handling any input, so a big current document only needs
+-- the part around the cursor loading before it's shown.
+local progressive = false
 
-	local function readl(): string?
-		local s = fp:read("*l")
-		if s then
-			return s:gsub("\r", "")
-		end
-		return nil
+do
+	local function cb()
+		progressive = true
 	end
 
-	while true do
-		local line = readl()
-		if not line then
-			break
-		end
-		assert(line)
-
-		if line:find("^%.") then
-			local s, _, k: any, p: any, v: any
-				= line:find("^(.*)%.([^.:]+): (.*)$")
-			if not s then
-				error(
-					string.format("malformed line when reading file: '%s'", line))
-			end
-
-			-- This is setting a property value.
-			local o: any = data
-			for e in k:gmatch("[^.]+") do
-				local en: any = e
-				if e:find('^[0-9]+$') then
-					en = assert(tonumber(e))
-				end
-				if not o[en] then
-					if (o == data.documents) then
-						o[en] = CreateDocument()
-					else
-						o[en] = {}
-					end
-				end
-				o = o[en]
-			end
-
-			if v:find('^-?[0-9][0-9.e+-]*$') then
-				v = tonumber(v)
-			elseif (v == "true") then
-				v = true
-			elseif (v == "false") then
-				v = false
-			elseif v:find('^".*"$') then
-				v = v:sub(2, -2)
-				v = unescape(v)
-			else
-				error(
-					string.format("malformed property %s.%s: %s", k, p, v))
-			end
-
-			if p:find('^[0-9]+$') then
-				p = tonumber(p)
-			end
-
-			o[p] = v
-		elseif line:find("^#") then
-			local id = line:sub(2)
-			local doc: Document
-			if id == "clipboard" then
-				doc = assert(data.clipboard)
-			else
-				local n = assert(tonumber(id))
-				doc = data.documents[n]
-			end
-
-			local index = 1
-			while true do
-				line = readl()
-				if not line or (line == ".") then
-					break
-				end
+	AddEventListener("ScreenInitialised", cb)
+end
 
-				local words = SplitString(line, " ")
-				local para = CreateParagraph(unpack(words))
+-- Loads a text or binary dumpfile, which is parsed by the native code in
+-- dumpfile.cc; load is called with the new document set and fills it in.
+-- If progress is set, the current document may be left partly loaded.
+local function loaddumpfile(load: (DocumentSet) -> (), progress: boolean?): DocumentSet
+	local data = CreateDocumentSet()
+	data.menu = CreateMenuTree()
+	data.documents = {}
 
-				doc[index] = para
-				index = index + 1
-			end
-		elseif line == "" then
-			-- Just ignore these.
-		else
-			error(
-				string.format("malformed line when reading file: '%s'", line))
-		end
-	end
+	load(data)
 
 	-- Bugfix: previously, the document metadata was written twice to the file,
 	-- once using the numeric document index as key and once using the name
@@ -582,8 +627,19 @@ local function loadfromstreamt(fp): DocumentSet
 	data._documentIndex = {}
 	for i, d in data.documents do
 		data._documentIndex[d.name] = d
+
+		-- Documents with their text in the file haven't changed from it, and
+		-- nothing that happened while loading counts as a change.
+		if d._source then
+			d._changed = false
+		end
+		d._changes = nil
 	end
 	data.current = data.documents[data.current :: any]
+	local current = data.current
+	if current then
+		current:materialise((progress and progressive) and current.cp or nil)
+	end
 
 	-- Remove any clipboard (unused).
 	data.clipboard = nil
@@ -591,31 +647,78 @@ local function loadfromstreamt(fp): DocumentSet
 	return data
 end
 
+-- Parses a text dumpfile, starting at offset (just after the magic line).
+-- If lazy is set, only the current document's paragraphs are loaded; the
+-- others are loaded when they're first needed (see Document.materialise()).
+local function loadfromstringt(s: Source, offset: number, lazy: boolean?): DocumentSet
+	return loaddumpfile(
+		function(data)
+			LoadTextDumpfile(s, offset, data, CreateDocument, Paragraph, lazy)
+		end, lazy)
+end
+
+-- Parses a binary dumpfile.
+local function loadfrombinary(s: Source): DocumentSet
+	local data = loaddumpfile(
+		function(data)
+			LoadBinaryDump(s, data, CreateDocument, Paragraph)
+		end)
+
+	-- Every paragraph came from the file.
+	for _, d in data.documents do
+		d._changed = false
+	end
+	return data
+end
+
 function LoadFromHeaderlessString(s)
-	return loadfromstreamt(CreateIStream(s))
+	return loadfromstringt(s, 1)
 end
 
-function LoadFromString(filename: string, data: string): (DocumentSet?, string?)
-	local fp = CreateIStream(data)
+-- data may be a string or a mapped file (see LoadFromFile()).
+function LoadFromString(filename: string, data: Source): (DocumentSet?, string?)
+	if data:sub(1, #GZMAGIC) == GZMAGIC then
+		local d = decompress(data)
+		if not d then
+			return nil, ("'"..filename.."' is not a valid gzip file.")
+		end
+		data = d
+	end
+
+	-- All the magic lines are shorter than this.
+	local header = data:sub(1, 80)
+	local e = header:find("\n", 1, true)
+	local magic = header:sub(1, (e or 0) - 1):gsub("\r", "")
+	local offset = e and (e + 1) or (#data + 1)
 
 	local loader = nil
-	local magic = fp:read("*l"):gsub("\r", "")
 	if (magic == MAGIC) then
 		loader = loadfromstream
 	elseif (magic == ZMAGIC) then
 		loader = loadfromstreamz
 	elseif (magic == TMAGIC) then
-		loader = loadfromstreamt
+		-- This one is parsed straight from the data.
+		return loadfromstringt(data, offset, true)
+	elseif (magic == BMAGIC) then
+		return loadfrombinary(data)
 	else
-		fp:close()
 		return nil, ("'"..filename.."' is not a valid WordGrinder file.")
 	end
 
+	-- The old formats are read as a stream, which needs a string.
+	local fp = CreateIStream(data:sub(1))
+	fp:read("*l")
 	return loader(fp)
 end
 
 function LoadFromFile(filename): (DocumentSet?, string?)
-	local data, _, e = wg.readfile(filename);
+	-- Where possible the file is mapped rather than read, and the native
+	-- loaders work straight from the mapping. Lazily loaded documents keep
+	-- it for as long as they need it.
+	local data: Source?, _, e = MapFile(filename)
+	if not data then
+		data, _, e = wg.readfile(filename)
+	end
 	if not data then
 		assert(e)
 		return nil, ("'"..filename.."' could not be opened: "..e)
@@ -688,6 +791,11 @@ function Cmd.LoadDocumentSet(filename): (boolean, string?)
 	documentSet:touch()
 
 	ResizeScreen()
+
+	-- The document is NOT dirty immediately after a load (although listeners
+	-- may change that).
+
+	documentSet._changed = false
 	FireEvent("DocumentLoaded")
 
 	UpdateDocumentStyles()
@@ -703,16 +811,20 @@ function Cmd.LoadDocumentSet(filename): (boolean, string?)
 			"to their default values.")
 	end
 
-	-- The document is NOT dirty immediately after a load.
-	
-	documentSet._changed = false
-
 	return true
 end
 
 function UpgradeDocument(oldversion)
 	documentSet.addons = documentSet.addons or {}
 
+	-- Upgrades may need to look at every paragraph, and every document
+	-- needs saving in the new format.
+
+	for _, document in ipairs(documentSet.documents) do
+		document:materialise()
+		document:invalidateCounts()
+	end
+
 	-- Upgrade version 1 to 2.
 
 	if (oldversion < 2) then
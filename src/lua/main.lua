@@ -53,6 +53,50 @@ function CancelQuit()
     Quitting = false
 end
 
+-- Compiles a chunk of Lua, using a bytecode cache so that scripts which are
+-- run repeatedly (via --lua or --exec) only go through the compiler once. The
+-- cache key covers the bytecode format and WordGrinder version as well as the
+-- source, so upgrading either invalidates old entries. Cached entries carry
+-- their length and hash, and anything which doesn't validate is recompiled.
+
+function LoadStringWithCache(data: string, name: string?, cachedir: string?)
+    local tag = string.format("WGBC %d %s", wg.BYTECODEVERSION, VERSION)
+    local dir = cachedir or (CONFIGDIR.."/cache")
+    local filename = dir.."/"..wg.hash(tag.."\0"..data)..".luauc"
+
+    local cached = ReadFile(filename)
+    if cached then
+        local _, e, header, len, hash =
+            cached:find("^([^\n]*) (%d+) (%x+)\n")
+        if header == tag then
+            local bytecode = cached:sub(e+1)
+            if (#bytecode == tonumber(len)) and (wg.hash(bytecode) == hash) then
+                local f = wg.loadbytecode(bytecode, name)
+                if f then
+                    return f
+                end
+            end
+        end
+    end
+
+    local bytecode, e = wg.compile(data, name)
+    if not bytecode then
+        return nil, e
+    end
+
+    -- Failing to write the cache is not an error.
+
+    if Mkdirs(dir) then
+        local header = string.format("%s %d %s\n", tag, #bytecode, wg.hash(bytecode))
+        local _, e = wg.writefile(filename..".new", header..bytecode)
+        if not e then
+            wg.rename(filename..".new", filename)
+        end
+    end
+
+    return wg.loadbytecode(bytecode, name)
+end
+
 local oldcp, oldcw, oldco
 function QueueRedraw()
     redrawpending = true
@@ -193,7 +237,7 @@ function WordProcessor(filename: string? | {any})
             -- not, look it up in the menu hierarchy.
 
             if not c:match("^KEY_") then
-                Cmd.Checkpoint()
+                Cmd.CheckpointTyping()
                 Cmd.TypeWhileSelected()
 
                 local payload = { value = c }
@@ -235,7 +279,7 @@ function WordProcessor(filename: string? | {any})
         local nl = string.char(13)
         while true do
             if documentSet._justchanged then
-                FireEvent("Changed")
+                FireEvent("Changed", currentDocument:takeChanges())
                 documentSet._justchanged = false
             end
 
@@ -248,6 +292,15 @@ function WordProcessor(filename: string? | {any})
                     redrawpending = false
                 end
 
+                -- A big document may only have been partly loaded so that it
+                -- could be shown quickly. Now it's on the screen, load the
+                -- rest before doing anything else.
+                if currentDocument:isPartial() then
+                    currentDocument:materialise()
+                    FireEvent("Changed", currentDocument:takeChanges())
+                    RedrawScreen()
+                end
+
                 c = GetCharWithBlinkingCursor(IDLE_TIME)
                 if (c == "KEY_TIMEOUT") then
                     FireEvent("Idle")
@@ -349,7 +402,11 @@ the program starts up (but after any --lua files). It defaults to:
                 CLIError("--lua must have an argument")
             end
 
-            local f, e = loadfile(opt)
+            local data, e = ReadFile(opt)
+            local f
+            if data then
+                f, e = LoadStringWithCache(data, opt)
+            end
             if e then
                 CLIError("user script compilation error: "..e)
             end
@@ -365,7 +422,7 @@ the program starts up (but after any --lua files). It defaults to:
                 CLIError("--exec must have an argument")
             end
 
-            local f, e = loadstring(opt)
+            local f, e = LoadStringWithCache(opt)
             if e then
                 CLIError("user script compilation error: "..e)
             end
@@ -55,7 +55,21 @@ local style_name_controller: MarginController =
 local paragraph_number_controller: MarginController =
 {
 	attach = function(self: MarginController)
-		local cb = function()
+		local cb = function(event, token, changes: ChangeLog?)
+			-- Only adding or removing paragraphs can change the margin width.
+			if changes and not changes.all then
+				local resized = false
+				for _, c in changes do
+					if c.kind ~= "changed" then
+						resized = true
+						break
+					end
+				end
+				if not resized then
+					return
+				end
+			end
+
 			local nm = int(math.log10(#currentDocument)) + 1
 			if nm ~= currentDocument.margin then
 				currentDocument.margin = nm
@@ -177,6 +177,8 @@ local ExportMenu = CreateMenu("Export current document",
 local DocumentSettingsMenu = CreateMenu("Document settings",
 {
     E("FSautosave",     "A", "Autosave...",       nil,         Cmd.ConfigureAutosave),
+    E("FSjournal",      "J", "Crash recovery...", nil,         Cmd.ConfigureJournal),
+    E("FSfileformat",   "F", "File format...",    nil,         Cmd.ConfigureFileFormat),
     E("FSscrapbook",    "S", "Scrapbook...",      nil,         Cmd.ConfigureScrapbook),
     E("FSHTMLExport",   "H", "HTML export...",    nil,         Cmd.ConfigureHTMLExport),
 	E("FSPageCount",    "P", "Page count...",     nil,         Cmd.ConfigurePageCount),
@@ -183,10 +183,7 @@ function Cmd.InsertStringIntoWord(c)
 	if not co then
 		return false
 	else
-		currentDocument[cp] = CreateParagraph(paragraph.style,
-			paragraph:sub(1, cw-1),
-			s,
-			paragraph:sub(cw+1))
+		currentDocument:setParagraph(cp, paragraph:replaceWord(cw, s))
 		currentDocument.co = co
 
 		documentSet:touch()
@@ -244,11 +241,9 @@ function Cmd.SplitCurrentWord()
 	local left = DeleteFromWord(word, co, #word+1)
 	local right = DeleteFromWord(word, 1, co)
 
-	currentDocument[cp] = CreateParagraph(paragraph.style,
-		paragraph:sub(1, cw-1),
-		left,
-		styleprime..right,
-		paragraph:sub(cw+1))
+	paragraph = paragraph:replaceWord(cw, left)
+	currentDocument:setParagraph(cp,
+		paragraph:insertWords(cw+1, {styleprime..right}))
 
 	currentDocument.cw = cw + 1
 	currentDocument.co = 1 + styleprimelen -- yes, this means that co has a minimum of 2
@@ -264,9 +259,9 @@ function Cmd.JoinWithNextParagraph()
 		return false
 	end
 
-	currentDocument[cp] = CreateParagraph(currentDocument[cp].style,
-		currentDocument[cp],
-		currentDocument[cp+1])
+	local paragraph = currentDocument[cp]
+	currentDocument:setParagraph(cp,
+		paragraph:insertWords(#paragraph+1, currentDocument[cp+1]))
 	currentDocument:deleteParagraphAt(cp+1)
 
 	documentSet:touch()
@@ -288,10 +283,8 @@ function Cmd.JoinWithNextWord()
 	local word, co, _ = InsertIntoWord(paragraph[cw+1], paragraph[cw], 1, 0)
 	if word and co then
 		currentDocument.co = co
-		currentDocument[cp] = CreateParagraph(paragraph.style,
-			paragraph:sub(1, cw-1),
-			word,
-			paragraph:sub(cw+2))
+		paragraph = paragraph:replaceWord(cw, word)
+		currentDocument:setParagraph(cp, paragraph:removeWords(cw+1, cw+1))
 
 		documentSet:touch()
 		QueueRedraw()
@@ -323,10 +316,8 @@ function Cmd.DeleteNextChar()
 	end
 	assert(nextco)
 
-	currentDocument[cp] = CreateParagraph(paragraph.style,
-		paragraph:sub(1, cw-1),
-		DeleteFromWord(word, co, nextco),
-		paragraph:sub(cw+1))
+	currentDocument:setParagraph(cp, paragraph:replaceWord(cw,
+		DeleteFromWord(word, co, nextco)))
 
 	documentSet:touch()
 	QueueRedraw()
@@ -348,10 +339,8 @@ function Cmd.DeleteWordLeftOfCursor()
 	local paragraph = currentDocument[cp]
 	local word = paragraph[cw]
 
-	currentDocument[cp] = CreateParagraph(paragraph.style,
-		paragraph:sub(1, cw-1),
-		DeleteFromWord(word, 1, co),
-		paragraph:sub(cw+1))
+	currentDocument:setParagraph(cp, paragraph:replaceWord(cw,
+		DeleteFromWord(word, 1, co)))
 	currentDocument.co = 1
 
 	documentSet:touch()
@@ -396,7 +385,7 @@ function Cmd.SplitCurrentParagraph()
 	local p2style = documentStyles[p1.style].nextstyle or p1.style
 	local p2 = CreateParagraph(p2style, paragraph:sub(cw))
 
-	currentDocument[cp] = p2
+	currentDocument:setParagraph(cp, p2)
 	currentDocument:insertParagraphBefore(p1, cp)
 	currentDocument.cp = currentDocument.cp + 1
 	currentDocument.cw = 1
@@ -583,10 +572,10 @@ function Cmd.ApplyStyleToSelection(s)
 			words[#words+1] = word
 		end
 
-		currentDocument[p] = CreateParagraph(paragraph.style,
+		currentDocument:setParagraph(p, CreateParagraph(paragraph.style,
 			paragraph:sub(1, firstword-1),
 			words,
-			paragraph:sub(lastword+1))
+			paragraph:sub(lastword+1)))
 	end
 
 	Cmd.UnsetMark()
@@ -654,6 +643,7 @@ end
 
 function Cmd.TerminateProgram()
 	if ConfirmDocumentErasure() then
+		FireEvent("Exit")
 		wg.exit(0)
 	end
 
@@ -676,7 +666,7 @@ function Cmd.ChangeParagraphStyle(style)
 	end
 
 	for p = first, last do
-		currentDocument[p] = CreateParagraph(style, currentDocument[p])
+		currentDocument:setParagraph(p, CreateParagraph(style, currentDocument[p]))
 	end
 
 	documentSet:touch()
@@ -791,8 +781,8 @@ function Cmd.Copy(keepselection: boolean?)
 	local paragraph
 	if (mw1 > 1) then
 		paragraph = buffer[1]
-		buffer[1] = CreateParagraph(paragraph.style,
-			paragraph:sub(mw1))
+		buffer:setParagraph(1, CreateParagraph(paragraph.style,
+			paragraph:sub(mw1)))
 		if (mp1 == mp2) then
 			mw2 = mw2 - mw1 + 1
 		end
@@ -803,8 +793,8 @@ function Cmd.Copy(keepselection: boolean?)
 
 	paragraph = buffer[#buffer]
 	if (mw2 < #paragraph) then
-		buffer[#buffer] = CreateParagraph(paragraph.style,
-			paragraph:sub(1, mw2))
+		buffer:setParagraph(#buffer, CreateParagraph(paragraph.style,
+			paragraph:sub(1, mw2)))
 	end
 
 	-- Remove any characters in the trailing word that weren't copied.
@@ -812,9 +802,9 @@ function Cmd.Copy(keepselection: boolean?)
 	paragraph = buffer[#buffer]
 	local word = paragraph[#paragraph]
 	if word then
-		buffer[#buffer] = CreateParagraph(paragraph.style,
+		buffer:setParagraph(#buffer, CreateParagraph(paragraph.style,
 			paragraph:sub(1, #paragraph-1),
-			DeleteFromWord(word, mo2, word:len()+1))
+			DeleteFromWord(word, mo2, word:len()+1)))
 	end
 
 	-- Remove any characters in the leading word that weren't copied.
@@ -822,9 +812,9 @@ function Cmd.Copy(keepselection: boolean?)
 	paragraph = buffer[1]
 	local word = paragraph[1]
 	if word then
-		buffer[1] = CreateParagraph(paragraph.style,
+		buffer:setParagraph(1, CreateParagraph(paragraph.style,
 			{DeleteFromWord(word, 1, mo1)},
-			paragraph:sub(2))
+			paragraph:sub(2)))
 	end
 
 	buffer:renumber()
@@ -855,10 +845,8 @@ function Cmd.Paste()
 	Cmd.SplitCurrentWord()
 	local paragraph = currentDocument[currentDocument.cp]
 
-	currentDocument[currentDocument.cp] = CreateParagraph(paragraph.style,
-		paragraph:sub(1, cw),
-		buffer[1],
-		paragraph:sub(cw+1))
+	currentDocument:setParagraph(currentDocument.cp,
+		paragraph:insertWords(cw+1, buffer[1]))
 	currentDocument.cw = currentDocument.cw + #buffer[1]
 	currentDocument.co = 1
 
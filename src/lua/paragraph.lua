@@ -7,6 +7,7 @@ local table_insert = table.insert
 local table_concat = table.concat
 local Write = wg.write
 local WriteStyled = wg.writestyled
+local WriteLine = wg.writeline
 local ClearToEOL = wg.cleartoeol
 local SetNormal = wg.setnormal
 local SetBold = wg.setbold
@@ -16,6 +17,7 @@ local SetDim = wg.setdim
 local GetStringWidth = wg.getstringwidth
 local GetBytesOfCharacter = wg.getbytesofcharacter
 local GetWordText = wg.getwordtext
+local WrapParagraph = wg.wrapparagraph
 local BOLD = wg.BOLD
 local ITALIC = wg.ITALIC
 local UNDERLINE = wg.UNDERLINE
@@ -44,6 +46,16 @@ type WrapData = {
 	xs: {number},
 }
 
+-- Describes how a paragraph differs from an older one whose wrap data can be
+-- updated rather than recomputed: words first..last of the old paragraph
+-- (which had count words) were replaced.
+type WrapHint = {
+	wrapdata: WrapData,
+	first: number,
+	last: number,
+	count: number,
+}
+
 type Paragraph = {
 	[number]: string,
 	__iter: (self: Paragraph) -> (any, any, number),
@@ -52,9 +64,21 @@ type Paragraph = {
 	style: string,
 
 	_wrapdata: WrapData?,
+	_wraphint: WrapHint?,
+	_serial: number?,
+	_wordcount: number?,
+	_decorations: {[number]: number}?,
+	_decorationserial: number?,
 
 	copy: (self: Paragraph) -> Paragraph,
+	isMutable: (self: Paragraph) -> boolean,
+	replaceWord: (self: Paragraph, wn: number, word: string) -> Paragraph,
+	insertWords: (self: Paragraph, wn: number, words: {string}) -> Paragraph,
+	removeWords: (self: Paragraph, first: number, last: number) -> Paragraph,
+	inheritWrapData: (self: Paragraph, old: Paragraph,
+		first: number, last: number) -> Paragraph,
 	wrap: (self: Paragraph, width: number?) -> WrapData,
+	getDecorations: (self: Paragraph) -> {[number]: number},
 	renderLine: (self: Paragraph, line: Line, x: number, y: number) -> (),
 	renderMarkedLine: (self: Paragraph,
 		line: Line, x: number, y: number, width: number?, pn: number) -> (),
@@ -79,12 +103,25 @@ function Paragraph.__iter(self: Paragraph)
 	return iter, self, 0
 end
 
+-- Paragraphs are shared with the undo history, so they can only be modified
+-- in place if they were created since the last undo checkpoint. Each one is
+-- stamped with the serial number current when it was created, and
+-- FreezeParagraphs() (called at every checkpoint) bumps the serial, making
+-- every existing paragraph immutable.
+
+local serial = 0
+
+function FreezeParagraphs()
+	serial = serial + 1
+end
+
 function CreateParagraph(style: string, ...: ({string}|string)): Paragraph
 	if type(style) ~= "string" then
 		error("paragraph style is not a string")
 	end
 	local words = {
-		style = style
+		style = style,
+		_serial = serial,
 	}
 
 	for _, t in ipairs({...}) do
@@ -110,160 +147,204 @@ function Paragraph.copy(self: Paragraph): Paragraph
 	return CreateParagraph(self.style, words)
 end
 
+function Paragraph.isMutable(self: Paragraph): boolean
+	return self._serial == serial
+end
+
+-- Replaces words first..last with the contents of words. The paragraph is
+-- changed in place if it's mutable; otherwise the change is made to a copy.
+-- Either way the result is returned and must be stored by the caller.
+local function splice(self: Paragraph, first: number, last: number,
+		words: {string}): Paragraph
+	local p = self
+	if not p:isMutable() then
+		p = self:copy()
+	end
+	p:inheritWrapData(self, first, last)
+	p._decorations = nil
+	p._decorationserial = nil
+
+	local count = #p
+	local removed = last - first + 1
+	local inserted = #words
+	if removed ~= inserted then
+		table.move(p, last+1, count, first+inserted)
+		for i = count - removed + inserted + 1, count do
+			p[i] = nil
+		end
+	end
+	for i = 1, inserted do
+		p[first+i-1] = words[i]
+	end
+	return p
+end
+
+function Paragraph.replaceWord(self: Paragraph, wn: number, word: string): Paragraph
+	return splice(self, wn, wn, {word})
+end
+
+-- Inserts words before word wn (which may be one past the end).
+function Paragraph.insertWords(self: Paragraph, wn: number, words: {string}): Paragraph
+	return splice(self, wn, wn-1, words)
+end
+
+function Paragraph.removeWords(self: Paragraph, first: number, last: number): Paragraph
+	return splice(self, first, last, {})
+end
+
+-- Tells a paragraph that it's an edited version of old, where words
+-- first..last of old have been replaced, so that the next wrap can update
+-- old's wrap data instead of starting from scratch. The wrap data is taken
+-- away from old, which will rewrap from scratch if it's ever needed again.
+-- Returns self.
+function Paragraph.inheritWrapData(self: Paragraph, old: Paragraph,
+		first: number, last: number): Paragraph
+	local wrapdata = old._wrapdata
+	local hint = old._wraphint
+	if wrapdata then
+		old._wrapdata = nil
+		self._wraphint = {
+			wrapdata = wrapdata,
+			first = first,
+			last = last,
+			count = #old,
+		}
+	elseif hint then
+		-- old was never wrapped; merge the two edits, translating last back
+		-- into the numbering of the paragraph the wrap data belongs to.
+		old._wraphint = nil
+		local olddelta = #old - hint.count
+		if last > (hint.last + olddelta) then
+			last = last - olddelta
+		else
+			last = hint.last
+		end
+		self._wraphint = {
+			wrapdata = hint.wrapdata,
+			first = math.min(first, hint.first),
+			last = last,
+			count = hint.count,
+		}
+	end
+	return self
+end
+
 function Paragraph.wrap(self: Paragraph, width: number?): ()
 	width = width or currentDocument._wrapwidth or 80
 	assert(width)
 
 	if not self._wrapdata or self._wrapdata.wrapwidth ~= width then
-		local wrapdata = {}
-		wrapdata.wrapwidth = width
-
-		-- Recompute sentences.
-		
-		local issentence = true
-		local sentences = {}
-		for wn, word in self do
-			if issentence then
-				sentences[wn] = true
-				issentence = false
-			end
+		local indent1 = self:getIndentOfLine(1)
+		local indent2 = self:getIndentOfLine(2)
+		local fullstopspaces = WantFullStopSpaces()
 
-			if word:find("[^%a]$") then
-				issentence = true
-			end
+		local wrapdata
+		local hint = self._wraphint
+		self._wraphint = nil
+		if hint and (hint.wrapdata.wrapwidth == width) then
+			wrapdata = WrapParagraph(self, width, indent1, indent2,
+				fullstopspaces, hint.wrapdata, hint.first, hint.last,
+				#self - hint.count)
+		else
+			wrapdata = WrapParagraph(self, width, indent1, indent2,
+				fullstopspaces)
 		end
-		sentences[#self] = true
-		wrapdata.sentences = sentences
-
-		-- Recompute line wrapping.
-		
-		local lines = {}
-		local line = {wn = 1}
-		local w = 0
-		local xs = {}
-		local fullstopspaces = WantFullStopSpaces()
+		wrapdata.wrapwidth = width
+		self._wrapdata = wrapdata
+		return wrapdata
+	else
+		return self._wrapdata
+	end
+end
 
-		width = width - self:getIndentOfLine(1)
+-- Decorations are extra attributes for words, such as the spellchecker's
+-- highlighting of misspelt words. They're worked out for a whole paragraph
+-- at a time by the DecorateParagraph listeners, and cached until either the
+-- paragraph changes or InvalidateDecorations() is called (which decorators
+-- must do when anything else they depend on changes).
 
-		for wn, word in ipairs(self) do
-			-- get width of word (including space)
-			local ww = GetStringWidth(word) + 1
+local decorationserial = 0
 
-			-- add an extra space if the user asked for it
-			if fullstopspaces and word:find("%.$") then
-				ww = ww + 1
-			end
+function InvalidateDecorations()
+	decorationserial = decorationserial + 1
+	QueueRedraw()
+end
 
-			xs[wn] = w
-			w = w + ww
-			if (w >= width) then
-				lines[#lines+1] = line
-				if #lines == 1 then
-					width = width + self:getIndentOfLine(1) - self:getIndentOfLine(2)
-				end
-				line = {wn = wn}
-				w = ww
-				xs[wn] = 0
-			end
+-- Returns a table mapping word numbers to extra attributes.
+function Paragraph.getDecorations(self: Paragraph): {[number]: number}
+	local decorations = self._decorations
+	if not decorations or (self._decorationserial ~= decorationserial) then
+		decorations = {}
+		-- Sentence starts don't depend on the width, so any existing wrap
+		-- will do; rewrapping here would replace one made at another width.
+		FireEvent("DecorateParagraph", {
+			paragraph = self,
+			sentences = (self._wrapdata or self:wrap()).sentences,
+			decorations = decorations,
+		})
+		self._decorations = decorations
+		self._decorationserial = decorationserial
+	end
+	return decorations
+end
 
-			line[#line+1] = wn
-		end
+-- DrawWord used to be fired for each word as it was drawn; it's been
+-- replaced by DecorateParagraph, but its listeners are still asked about
+-- each word. As the results are now cached, they must call
+-- InvalidateDecorations() when anything they depend on changes.
+do
+	local payload = {}
 
-		if (#line > 0) then
-			lines[#lines+1] = line
+	local function cb(event, token, p)
+		if not HasEventListeners("DrawWord") then
+			return
 		end
 
-		wrapdata.lines = lines
-		wrapdata.xs = xs
-		self._wrapdata = wrapdata
-		return wrapdata
-	else
-		return self._wrapdata
+		local paragraph = p.paragraph
+		local decorations = p.decorations
+		local cstyle = stylemarkup[paragraph.style] or 0
+		for wn, word in paragraph do
+			payload.word = word
+			payload.cstyle = cstyle
+			payload.firstword = p.sentences[wn]
+			FireEvent("DrawWord", payload)
+
+			if payload.cstyle ~= cstyle then
+				decorations[wn] = bit32.bor(decorations[wn] or 0, payload.cstyle)
+			end
+		end
 	end
+
+	AddEventListener("DecorateParagraph", cb)
 end
 
 function Paragraph.renderLine(self: Paragraph, line, x: number, y: number): ()
 	local cstyle = stylemarkup[self.style] or 0
-	local ostyle = 0
 	local wd = self._wrapdata
 	assert(wd)
 
-	for _, wn in ipairs(line) do
-		local w = self[wn]
-
-		local payload = {
-			word = w,
-			ostyle = ostyle,
-			cstyle = cstyle,
-			firstword = wd.sentences[wn]
-		}
-		FireEvent("DrawWord", payload)
-
-		ostyle = WriteStyled(
-			x+wd.xs[wn], y,
-			payload.word,
-			payload.ostyle, 0, 0, payload.cstyle)
-	end
+	WriteLine(x, y, self, wd.xs, line, cstyle, self:getDecorations())
 end
 
 function Paragraph.renderMarkedLine(self: Paragraph, line, x, y, width, pn): ()
-	width = width or (ScreenWidth - x)
-
-	local lwn: number = line.wn
-	local mp1, mw1, mo1, mp2, mw2, mo2 = currentDocument:getMarks()
-
 	local cstyle = stylemarkup[self.style] or 0
-	local ostyle = 0
-	for wn, w in ipairs(line) do
-		local s, e
-
-		wn = lwn + wn - 1
+	local wd = self:wrap()
 
-		if (pn < mp1) or (pn > mp2) then
-			s = 0
-		elseif (pn > mp1) and (pn < mp2) then
-			s = 1
-		else
-			if (pn == mp1) and (pn == mp2) then
-				if (wn == mw1) and (wn == mw2) then
-					s = mo1
-					e = mo2
-				elseif (wn == mw1) then
-					s = mo1
-				elseif (wn == mw2) then
-					s = 1
-					e = mo2
-				elseif (wn > mw1) and (wn < mw2) then
-					s = 1
-				end
-			elseif (pn == mp1) then
-				if (wn > mw1) then
-					s = 1
-				elseif (wn == mw1) then
-					s = mo1
-				end
-			else
-				s = 1
-				if (wn > mw2) then
-					s = 0
-				elseif (wn == mw2) then
-					e = mo2
-				end
-			end
+	-- Work out which part of this paragraph is marked.
+	local mp1, mw1, mo1, mp2, mw2, mo2 = currentDocument:getMarks()
+	local w1, o1, w2, o2
+	if (pn >= mp1) and (pn <= mp2) then
+		w1, o1 = 1, 1
+		if (pn == mp1) then
+			w1, o1 = mw1, mo1
+		end
+		if (pn == mp2) then
+			w2, o2 = mw2, mo2
 		end
-
-		local wd = self:wrap()
-		local payload = {
-			word = self[w],
-			ostyle = ostyle,
-			cstyle = cstyle,
-			firstword = wd.sentences[wn]
-		}
-		FireEvent("DrawWord", payload)
-
-		ostyle = WriteStyled(x+wd.xs[w], y, payload.word,
-			payload.ostyle, s, e, payload.cstyle)
 	end
+
+	WriteLine(x, y, self, wd.xs, line, cstyle, self:getDecorations(),
+		w1, o1, w2, o2)
 end
 
 -- returns: line number, word number in line
@@ -260,38 +260,20 @@ function RedrawScreen()
 	end
 	assert(sl)
 
-	-- So, line sl on sp is supposed to be in the middle. We now work up
-	-- and down to find the real cursor position.
+	-- So, line sl on sp is supposed to be in the middle. The line index
+	-- tells us how far away the cursor is from that.
 
 	local cy = math.floor(ScreenHeight / 2) - sl
-	if cp >= sp then
-		local p = sp
-		
-		while p < cp do
-			local wd = currentDocument[p]:wrap()
-			cy = cy + #wd.lines + currentDocument:spaceBelow(p)
-			p = p + 1
-		end
-		cy = cy + currentDocument[p]:getLineOfWord(cw) - 1
-		if cy >= (ScreenHeight-5) then
-			currentDocument._sp = cp
-			currentDocument._sw = cw
-			return RedrawScreen()
-		end
-	else
-		local p = sp
-
-		while p > cp do
-			p = p - 1
-			local wd = currentDocument[p]:wrap()
-			cy = cy - #wd.lines - currentDocument:spaceBelow(p)
-		end
-		cy = cy + currentDocument[p]:getLineOfWord(cw) - 1
-		if cy < 4 then
-			currentDocument._sp = cp
-			currentDocument._sw = cw
-			return RedrawScreen()
-		end
+	if cp ~= sp then
+		cy = cy + currentDocument:getLineOfParagraph(cp)
+			- currentDocument:getLineOfParagraph(sp)
+	end
+	cy = cy + currentDocument[cp]:getLineOfWord(cw) - 1
+	if ((cp >= sp) and (cy >= (ScreenHeight-5))) or
+			((cp < sp) and (cy < 4)) then
+		currentDocument._sp = cp
+		currentDocument._sw = cw
+		return RedrawScreen()
 	end
 
 	-- Position the cursor.
@@ -0,0 +1,37 @@
+--!nonstrict
+loadfile("tests/testsuite.lua")()
+
+Cmd.InsertStringIntoParagraph("fnord")
+local dir = wg.mkdtemp()
+AssertEquals(Cmd.SaveCurrentDocumentAs(dir.."/tempfile.wg"), true)
+
+local autosaved = nil
+AddEventListener("Autosaved",
+	function(event, token, filename)
+		autosaved = filename
+	end)
+
+local settings = documentSet.addons.autosave
+settings.enabled = true
+settings.period = 0
+settings.pattern = "autosave.wg"
+GlobalSettings.directories.autosaves = dir
+settings.lastsaved = os.time() - 1
+
+-- The autosave is written in the background, from a snapshot of the
+-- document set taken when it starts.
+
+Cmd.InsertStringIntoWord("!")
+FireEvent("Idle")
+Cmd.InsertStringIntoWord("?")
+
+local deadline = wg.time() + 10
+while not autosaved and (wg.time() < deadline) do
+	FireEvent("WaitingForUser")
+end
+AssertEquals(dir.."/autosave.wg", autosaved)
+AssertTableEquals({"fnord!?"}, currentDocument[1])
+
+documentSet._changed = false
+AssertEquals(Cmd.LoadDocumentSet(autosaved), true)
+AssertTableEquals({"fnord!"}, currentDocument[1])
@@ -0,0 +1,56 @@
+--!nonstrict
+loadfile("tests/testsuite.lua")()
+
+currentDocument:setParagraph(1, CreateParagraph("P", "fnord"))
+currentDocument:appendParagraph(CreateParagraph("P"))
+currentDocument:appendParagraph(CreateParagraph("H1", "fnord", "fnord"))
+Cmd.AddBlankDocument("other")
+currentDocument:setParagraph(1, CreateParagraph("P", "blarg", "\"quoted\""))
+
+local dir = wg.mkdtemp()
+local filename = dir.."/tempfile.wg"
+documentSet.addons.fileformat.binary = true
+AssertEquals(Cmd.SaveCurrentDocumentAs(filename), true)
+
+local data = wg.readfile(filename)
+AssertEquals("WordGrinder dumpfile v4: this is not a text file!\n",
+	data:sub(1, 50))
+
+local function check()
+	Cmd.ChangeDocument("main")
+	AssertEquals(3, #currentDocument)
+	AssertTableEquals({"fnord"}, currentDocument[1])
+	AssertTableEquals({}, currentDocument[2])
+	AssertTableEquals({"fnord", "fnord"}, currentDocument[3])
+	AssertEquals("P", currentDocument[2].style)
+	AssertEquals("H1", currentDocument[3].style)
+	Cmd.ChangeDocument("other")
+	AssertEquals(1, #currentDocument)
+	AssertTableEquals({"blarg", "\"quoted\""}, currentDocument[1])
+	AssertEquals(true, documentSet.addons.fileformat.binary)
+end
+
+-- Binary files can be loaded from the file and from a string.
+
+AssertEquals(Cmd.LoadDocumentSet(filename), true)
+AssertEquals("other", currentDocument.name)
+AssertEquals(false, currentDocument._changed)
+check()
+
+local d = LoadFromString(filename, data)
+AssertEquals(2, #d.documents)
+AssertTableEquals({"fnord", "fnord"}, d.documents[1][3])
+
+-- Saving again writes the same file.
+
+AssertEquals(Cmd.SaveCurrentDocument(), true)
+AssertEquals(data, wg.readfile(filename))
+
+-- Switching back to the text format.
+
+documentSet.addons.fileformat.binary = false
+AssertEquals(Cmd.SaveCurrentDocument(), true)
+AssertEquals("WordGrinder dumpfile v3", wg.readfile(filename):sub(1, 23))
+AssertEquals(Cmd.LoadDocumentSet(filename), true)
+documentSet.addons.fileformat.binary = true
+check()
@@ -0,0 +1,42 @@
+--!nonstrict
+loadfile("tests/testsuite.lua")()
+
+local dir = wg.mkdtemp()
+
+-- The first load compiles and populates the cache.
+
+local f, e = LoadStringWithCache("return 1 + ...", "test", dir)
+AssertNull(e)
+AssertEquals(3, f(2))
+
+local files = wg.readdir(dir)
+local cachefile
+for _, name in ipairs(files) do
+	if name:find("%.luauc$") then
+		cachefile = dir.."/"..name
+	end
+end
+AssertNotNull(cachefile)
+
+-- The second load comes from the cache.
+
+local data = wg.readfile(cachefile)
+f, e = LoadStringWithCache("return 1 + ...", "test", dir)
+AssertNull(e)
+AssertEquals(4, f(3))
+AssertEquals(data, wg.readfile(cachefile))
+
+-- Corrupt cache entries are ignored and rewritten.
+
+wg.writefile(cachefile, data:sub(1, #data - 3))
+f, e = LoadStringWithCache("return 1 + ...", "test", dir)
+AssertNull(e)
+AssertEquals(5, f(4))
+AssertEquals(data, wg.readfile(cachefile))
+
+-- Compilation errors are reported and not cached.
+
+f, e = LoadStringWithCache("return +", "broken", dir)
+AssertNull(f)
+AssertNotNull(e:find("^broken:1:"))
+AssertEquals(3, #wg.readdir(dir))
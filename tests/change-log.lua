@@ -0,0 +1,57 @@
+--!nonstrict
+loadfile("tests/testsuite.lua")()
+
+local function kinds(log)
+	local t = {}
+	for _, c in log do
+		t[#t+1] = c.kind..c.pn
+	end
+	return t
+end
+
+currentDocument:takeChanges()
+
+-- Typing into a paragraph is logged once.
+
+Cmd.InsertStringIntoParagraph("one two three")
+AssertTableEquals({"changed1"}, kinds(currentDocument:takeChanges()))
+AssertTableEquals({}, kinds(currentDocument:takeChanges()))
+
+-- Paragraph indices are as they were at the time of each change.
+
+Cmd.SplitCurrentParagraph()
+Cmd.InsertStringIntoParagraph("four")
+currentDocument.cp = 1
+currentDocument.cw = 1
+currentDocument.co = 1
+Cmd.JoinWithNextParagraph()
+AssertTableEquals({"changed1", "inserted1", "changed2", "changed1", "deleted2"},
+	kinds(currentDocument:takeChanges()))
+
+-- Listeners receive the log with the Changed event.
+
+local received
+local token = AddEventListener("Changed",
+	function(event, token, changes)
+		received = changes
+	end)
+Cmd.InsertStringIntoParagraph("five")
+FireEvent("Changed", currentDocument:takeChanges())
+RemoveEventListener(token)
+AssertTableEquals({"changed1"}, kinds(received))
+
+-- Undo only logs the paragraphs it restores.
+
+Cmd.Checkpoint()
+Cmd.SplitCurrentParagraph()
+currentDocument:takeChanges()
+Cmd.Undo()
+AssertTableEquals({"deleted1", "changed1"},
+	kinds(currentDocument:takeChanges()))
+
+-- Very long logs collapse.
+
+for i = 1, 300 do
+	currentDocument:insertParagraphBefore(CreateParagraph("P", {"x"}), 1)
+end
+AssertEquals(true, currentDocument:takeChanges().all)
@@ -18,3 +18,39 @@ AssertEquals("directory", t.mode)
 t, _, errno = wg.stat(dir.."/foo/bar/bloo")
 AssertEquals(wg.ENOENT, errno)
 
+local fp, _, errno = wg.openfile(dir.."/foo/file", "w")
+AssertEquals(nil, errno)
+AssertEquals(true, fp:write("one", " ", "two"))
+AssertEquals(true, fp:flush())
+AssertEquals("one two", wg.readfile(dir.."/foo/file"))
+fp:write("\nthree")
+AssertEquals(true, fp:close())
+AssertEquals("one two\nthree", wg.readfile(dir.."/foo/file"))
+AssertEquals(false, pcall(fp.write, fp, "four"))
+
+fp = wg.openfile(dir.."/foo/file", "a")
+fp:write("four")
+fp:close()
+AssertEquals("one two\nthreefour", wg.readfile(dir.."/foo/file"))
+
+fp, _, errno = wg.openfile(dir.."/foo/bloo/file", "w")
+AssertEquals(nil, fp)
+AssertEquals(wg.ENOENT, errno)
+
+AssertEquals(true, wg.writefile(dir.."/foo/file", "one two"))
+AssertEquals("one two", wg.readfile(dir.."/foo/file"))
+
+local fragments = {}
+for i = 1, 1000 do
+	fragments[#fragments+1] = ""
+	fragments[#fragments+1] = string.rep("x", i % 7)
+	fragments[#fragments+1] = i
+end
+local expected = table.concat(fragments)
+AssertEquals(true, wg.writefile(dir.."/foo/file", fragments))
+AssertEquals(expected, wg.readfile(dir.."/foo/file"))
+AssertEquals("number", type(fragments[3]))
+AssertEquals(false, pcall(wg.writefile, dir.."/foo/file", {"one", {}}))
+
+_, _, errno = wg.writefile(dir.."/foo/bloo/file", {"one"})
+AssertEquals(wg.ENOENT, errno)
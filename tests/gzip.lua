@@ -0,0 +1,58 @@
+--!nonstrict
+loadfile("tests/testsuite.lua")()
+
+-- Streams give the same results however the data is divided up.
+
+local text = {}
+for i = 1, 10000 do
+	text[#text+1] = tostring(i)
+end
+text = table.concat(text, " ")
+
+for _, gzip in {false, true} do
+	local compressor = wg.createcompressor(9, gzip)
+	local compressed = {}
+	for i = 1, #text, 1000 do
+		compressed[#compressed+1] = compressor:feed(text:sub(i, i+499),
+			text:sub(i+500, i+999))
+	end
+	compressed[#compressed+1] = compressor:finish()
+	compressed = table.concat(compressed)
+	AssertEquals(true, #compressed < #text)
+	AssertEquals(gzip, compressed:sub(1, 2) == "\31\139")
+
+	local decompressor = wg.createdecompressor()
+	local decompressed = {}
+	for i = 1, #compressed, 7 do
+		decompressed[#decompressed+1] =
+			decompressor:feed(compressed:sub(i, i+6))
+	end
+	decompressed[#decompressed+1] = decompressor:finish()
+	AssertEquals(text, table.concat(decompressed))
+end
+
+AssertEquals(text, wg.decompress(wg.compress(text)))
+
+local decompressor = wg.createdecompressor()
+decompressor:feed(wg.compress(text):sub(1, 100))
+AssertNull(decompressor:finish())
+
+-- Document sets with .gz filenames are saved compressed.
+
+Cmd.InsertStringIntoParagraph("fnord")
+Cmd.AddBlankDocument("other")
+Cmd.InsertStringIntoParagraph("blarg")
+
+local dir = wg.mkdtemp()
+local filename = dir.."/tempfile.wg.gz"
+AssertEquals(Cmd.SaveCurrentDocumentAs(filename), true)
+local data = wg.readfile(filename)
+AssertEquals("\31\139", data:sub(1, 2))
+AssertEquals("WordGrinder dumpfile v3",
+	wg.decompress(data):sub(1, 23))
+
+AssertEquals(Cmd.LoadDocumentSet(filename), true)
+Cmd.ChangeDocument("main")
+AssertTableEquals({"fnord"}, currentDocument[1])
+Cmd.ChangeDocument("other")
+AssertTableEquals({"blarg"}, currentDocument[1])
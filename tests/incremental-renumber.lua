@@ -0,0 +1,100 @@
+--!nonstrict
+loadfile("tests/testsuite.lua")()
+
+-- Recomputes the word count and list numbers from scratch, for comparison
+-- with the incrementally maintained ones.
+local function check(doc)
+	local wc = 0
+	local n = 1
+	for pn, p in ipairs(doc) do
+		wc = wc + #p
+		local style = documentStyles[p.style]
+		if style.numbered then
+			AssertEquals(n, p.number)
+			n = n + 1
+		elseif not style.list then
+			n = 1
+		end
+	end
+	AssertEquals(wc, doc.wordcount)
+end
+
+local styles = {"P", "LN", "LN", "LB", "L", "H1"}
+local function para(i)
+	local words = {}
+	for w = 1, i % 5 do
+		words[#words+1] = "w"..w
+	end
+	return CreateParagraph(styles[(i % #styles) + 1], words)
+end
+
+local doc = CreateDocument()
+for i = 1, 40 do
+	doc:appendParagraph(para(i))
+end
+doc:renumber()
+AssertEquals(true, doc._counted)
+check(doc)
+
+-- Edits only renumber the part of the list they affect.
+
+math.randomseed(1)
+for i = 1, 500 do
+	local pn = math.random(1, #doc)
+	local op = math.random(1, 5)
+	if op == 1 then
+		doc:insertParagraphBefore(para(math.random(1, 100)), pn)
+	elseif (op == 2) and (#doc > 1) then
+		doc:deleteParagraphAt(pn)
+	elseif op == 3 then
+		doc:setParagraph(pn, para(math.random(1, 100)))
+	elseif op == 4 then
+		local p = doc[pn]
+		doc:setParagraph(pn, CreateParagraph(p.style, p, "extra"))
+	else
+		doc:appendParagraph(para(math.random(1, 100)))
+	end
+
+	-- Sometimes let several changes accumulate before renumbering.
+	if math.random(1, 3) == 1 then
+		doc:renumber()
+		check(doc)
+	end
+end
+doc:renumber()
+check(doc)
+
+-- Modifying a paragraph in place is counted.
+
+local p = CreateParagraph("P", {"one"})
+doc:setParagraph(1, p)
+doc:renumber()
+doc:setParagraph(1, p:insertWords(2, {"two", "three"}))
+doc:renumber()
+check(doc)
+
+-- Editing commands keep the current document's counts up to date.
+
+Cmd.InsertStringIntoParagraph("one two three")
+Cmd.ChangeParagraphStyle("LN")
+Cmd.SplitCurrentParagraph()
+Cmd.InsertStringIntoParagraph("four five")
+FireEvent("Changed")
+AssertEquals(5, currentDocument.wordcount)
+check(currentDocument)
+
+Cmd.Checkpoint()
+Cmd.InsertStringIntoParagraph(" six")
+currentDocument.cp = 1
+currentDocument.cw = 1
+currentDocument.co = 1
+Cmd.JoinWithNextParagraph()
+FireEvent("Changed")
+AssertEquals(1, #currentDocument)
+AssertEquals(6, currentDocument.wordcount)
+check(currentDocument)
+
+Cmd.Undo()
+FireEvent("Changed")
+AssertEquals(5, currentDocument.wordcount)
+check(currentDocument)
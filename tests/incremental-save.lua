@@ -0,0 +1,57 @@
+--!nonstrict
+loadfile("tests/testsuite.lua")()
+
+Cmd.InsertStringIntoParagraph("fnord")
+Cmd.AddBlankDocument("other")
+Cmd.InsertStringIntoParagraph("blarg")
+Cmd.AddBlankDocument("third")
+Cmd.InsertStringIntoParagraph("wibble")
+
+local dir = wg.mkdtemp()
+local filename = dir.."/tempfile.wg"
+AssertEquals(Cmd.SaveCurrentDocumentAs(filename), true)
+
+-- Saving remembers where the text of each document is in the file, which is
+-- reused until the document changes.
+
+local function sourceof(d)
+	return d._source:sub(d._sourceoffset, d._sourceend - 1)
+end
+
+local third = documentSet:findDocument("third")
+AssertEquals(false, third._changed)
+AssertEquals("userdata", type(third._source))
+AssertEquals("P wibble\n", sourceof(third))
+
+Cmd.InsertStringIntoWord("!")
+AssertEquals(true, third._changed)
+AssertEquals(Cmd.SaveCurrentDocument(), true)
+AssertEquals(false, third._changed)
+AssertEquals("P wibble!\n", sourceof(third))
+AssertEquals("P blarg\n", sourceof(documentSet:findDocument("other")))
+
+-- After loading, unchanged documents are copied from the loaded file.
+
+AssertEquals(Cmd.LoadDocumentSet(filename), true)
+local original = wg.readfile(filename)
+third = documentSet:findDocument("third")
+AssertEquals(third, currentDocument)
+AssertEquals(false, third._changed)
+AssertEquals(true, third._sourceoffset > 1)
+
+Cmd.ChangeDocument("other")
+AssertEquals(false, currentDocument._changed)
+Cmd.InsertStringIntoWord("?")
+AssertEquals(true, currentDocument._changed)
+
+AssertEquals(Cmd.SaveCurrentDocument(), true)
+AssertEquals(false, currentDocument._changed)
+AssertEquals(original:gsub("P blarg\n", "P blarg?\n"), wg.readfile(filename))
+
+AssertEquals(Cmd.LoadDocumentSet(filename), true)
+Cmd.ChangeDocument("main")
+AssertTableEquals({"fnord"}, currentDocument[1])
+Cmd.ChangeDocument("other")
+AssertTableEquals({"blarg?"}, currentDocument[1])
+Cmd.ChangeDocument("third")
+AssertTableEquals({"wibble!"}, currentDocument[1])
@@ -0,0 +1,67 @@
+--!nonstrict
+loadfile("tests/testsuite.lua")()
+
+-- Edits which replace the current paragraph should update the old wrap data
+-- in place, and must produce the same result as wrapping from scratch.
+
+documentStyles["P"].indent = 2
+documentStyles["P"].firstindent = 4
+
+local function check()
+	local para = currentDocument[currentDocument.cp]
+	local got = para:wrap(30)
+	local want = para:copy():wrap(30)
+	AssertTableAndPropertiesEquals(want.lines, got.lines)
+	AssertTableAndPropertiesEquals(want.xs, got.xs)
+	AssertTableAndPropertiesEquals(want.sentences, got.sentences)
+end
+
+local words = {}
+for i = 1, 200 do
+	words[#words+1] = string.rep("x", 1 + (i * 7) % 11)
+	if (i % 13) == 0 then
+		words[#words] = words[#words].."."
+	end
+end
+Cmd.InsertStringIntoParagraph(table.concat(words, " "))
+check()
+
+currentDocument.cw = 100
+currentDocument.co = 1
+
+-- Typing into a word.
+
+local wrapdata = currentDocument[1]:wrap(30)
+Cmd.InsertStringIntoWord("abcdefghijklmnop")
+AssertNull(currentDocument[1]._wrapdata)
+AssertEquals(wrapdata, currentDocument[1]:wrap(30))
+check()
+
+-- Splitting, joining and deleting.
+
+Cmd.SplitCurrentWord()
+check()
+Cmd.InsertStringIntoWord("end.")
+check()
+Cmd.DeletePreviousChar()
+check()
+Cmd.GotoBeginningOfWord()
+Cmd.DeletePreviousChar()
+check()
+Cmd.DeleteWordLeftOfCursor()
+check()
+
+-- Several edits without an intervening wrap.
+
+Cmd.InsertStringIntoParagraph("one two three")
+currentDocument.cw = 20
+currentDocument.co = 1
+Cmd.InsertStringIntoParagraph("four five")
+check()
+
+-- Edits near the start of the paragraph fall back to a full wrap.
+
+currentDocument.cw = 1
+currentDocument.co = 1
+Cmd.InsertStringIntoWord("q")
+check()
@@ -0,0 +1,130 @@
+--!nonstrict
+loadfile("tests/testsuite.lua")()
+
+-- The journal only runs once the document set has been saved.
+
+Cmd.InsertStringIntoParagraph("fnord")
+local dir = wg.mkdtemp()
+local filename = dir.."/tempfile.wg"
+local journalname = filename..".journal"
+AssertEquals(Cmd.SaveCurrentDocumentAs(filename), true)
+documentSet.addons.journal.enabled = true
+documentSet.addons.journal.syncperiod = 0
+AssertEquals(Cmd.SaveCurrentDocument(), true)
+AssertNull(wg.stat(journalname))
+
+-- Edits are journalled after each command (which, in the real program, is
+-- done by the main loop).
+
+local function command(cmd, ...)
+	cmd(...)
+	FireEvent("Changed", currentDocument:takeChanges())
+end
+
+command(Cmd.SplitCurrentParagraph)
+command(Cmd.InsertStringIntoParagraph, "blarg")
+command(Cmd.SplitCurrentParagraph)
+command(Cmd.InsertStringIntoParagraph, "wibble")
+command(Cmd.SplitCurrentParagraph)
+command(Cmd.DeletePreviousChar)
+command(Cmd.GotoBeginningOfDocument)
+command(Cmd.GotoEndOfWord)
+command(Cmd.DeleteWordLeftOfCursor)
+command(Cmd.AddBlankDocument, "other")
+command(Cmd.InsertStringIntoParagraph, "new")
+
+-- Changes to documents other than the current one are journalled too.
+
+documentSet:findDocument("main"):appendParagraph(CreateParagraph("P", "extra"))
+FireEvent("Changed", currentDocument:takeChanges())
+
+local journal = wg.readfile(journalname)
+AssertNotNull(journal)
+
+-- Loading the document set again throws the journal away...
+
+documentSet._changed = false
+AssertEquals(Cmd.LoadDocumentSet(filename), true)
+AssertNull(wg.stat(journalname))
+AssertTableEquals({"fnord"}, currentDocument[1])
+AssertEquals(1, #currentDocument)
+
+-- ...but if it was left behind by a crash, the changes are recovered.
+
+wg.writefile(journalname, journal)
+documentSet._changed = false
+AssertEquals(Cmd.LoadDocumentSet(filename), true)
+AssertEquals(true, documentSet._changed)
+Cmd.ChangeDocument("main")
+AssertEquals(4, #currentDocument)
+AssertTableEquals({""}, currentDocument[1])
+AssertTableEquals({"blarg"}, currentDocument[2])
+AssertTableEquals({"wibble"}, currentDocument[3])
+AssertTableEquals({"extra"}, currentDocument[4])
+Cmd.ChangeDocument("other")
+AssertEquals(1, #currentDocument)
+AssertTableEquals({"new"}, currentDocument[1])
+
+-- Further changes are added to the recovered journal.
+
+command(Cmd.InsertStringIntoParagraph, "s")
+AssertEquals(true, #wg.readfile(journalname) > #journal)
+
+-- A journal for a different version of the file is ignored.
+
+AssertEquals(Cmd.SaveCurrentDocument(), true)
+AssertNull(wg.stat(journalname))
+wg.writefile(journalname, journal)
+AddAllowedMessage("Crash recovery failed")
+AssertEquals(Cmd.LoadDocumentSet(filename), true)
+AssertNotNull(wg.stat(journalname))
+Cmd.ChangeDocument("main")
+AssertTableEquals({""}, currentDocument[1])
+AssertTableEquals({"blarg"}, currentDocument[2])
+Cmd.ChangeDocument("other")
+AssertTableEquals({"news"}, currentDocument[1])
+
+-- ...even if the file's still the same size.
+
+AssertEquals(Cmd.SaveCurrentDocument(), true)
+local saved = wg.readfile(filename)
+command(Cmd.InsertStringIntoParagraph, "y")
+journal = wg.readfile(journalname)
+AssertEquals(Cmd.SaveCurrentDocument(), true)
+wg.writefile(filename, (saved:gsub("news", "nows")))
+wg.writefile(journalname, journal)
+documentSet._changed = false
+AssertEquals(Cmd.LoadDocumentSet(filename), true)
+Cmd.ChangeDocument("other")
+AssertTableEquals({"nows"}, currentDocument[1])
+
+-- Renaming and deleting documents are recovered too.
+
+AssertEquals(Cmd.SaveCurrentDocument(), true)
+command(Cmd.AddBlankDocument, "third")
+command(Cmd.InsertStringIntoParagraph, "gone")
+AssertEquals(true, documentSet:renameDocument("other", "renamed"))
+AssertEquals(true, documentSet:deleteDocument("third"))
+FireEvent("Changed", currentDocument:takeChanges())
+journal = wg.readfile(journalname)
+wg.writefile(journalname, journal)
+documentSet._changed = false
+AssertEquals(Cmd.LoadDocumentSet(filename), true)
+AssertEquals(2, #documentSet.documents)
+AssertNull(documentSet:findDocument("other"))
+AssertNull(documentSet:findDocument("third"))
+Cmd.ChangeDocument("renamed")
+AssertTableEquals({"nows"}, currentDocument[1])
+
+-- A journal which can't be applied changes nothing, and is left alone.
+
+AssertEquals(Cmd.SaveCurrentDocument(), true)
+command(Cmd.InsertStringIntoParagraph, "z")
+journal = wg.readfile(journalname)
+wg.writefile(journalname, journal..'@"renamed"\n=99 P bad\n')
+documentSet._changed = false
+AssertEquals(Cmd.LoadDocumentSet(filename), true)
+AssertNotNull(wg.stat(journalname))
+Cmd.ChangeDocument("renamed")
+AssertTableEquals({"nows"}, currentDocument[1])
+AssertEquals(false, documentSet._changed)
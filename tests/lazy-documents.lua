@@ -0,0 +1,46 @@
+--!nonstrict
+loadfile("tests/testsuite.lua")()
+
+Cmd.InsertStringIntoParagraph("fnord")
+Cmd.SplitCurrentParagraph()
+Cmd.InsertStringIntoParagraph("one two")
+Cmd.AddBlankDocument("other")
+Cmd.InsertStringIntoParagraph("blarg")
+Cmd.AddBlankDocument("third")
+Cmd.InsertStringIntoParagraph("wibble")
+
+local dir = wg.mkdtemp()
+local filename = dir.."/tempfile.wg"
+AssertEquals(Cmd.SaveCurrentDocumentAs(filename), true)
+AssertEquals(Cmd.LoadDocumentSet(filename), true)
+
+-- Only the current document is loaded.
+
+AssertEquals("third", currentDocument.name)
+AssertNull(currentDocument._unloaded)
+AssertTableEquals({"wibble"}, currentDocument[1])
+AssertEquals(true, documentSet:findDocument("main")._unloaded)
+AssertEquals(true, documentSet:findDocument("other")._unloaded)
+
+-- Unloaded documents are saved exactly as they were.
+
+local filename2 = dir.."/tempfile2.wg"
+AssertEquals(SaveToFile(filename2, documentSet), true)
+AssertEquals(wg.readfile(filename), wg.readfile(filename2))
+AssertEquals(true, documentSet:findDocument("main")._unloaded)
+
+-- Changing document loads it.
+
+Cmd.ChangeDocument("main")
+AssertNull(currentDocument._unloaded)
+AssertEquals(2, #currentDocument)
+AssertTableEquals({"fnord"}, currentDocument[1])
+AssertTableEquals({"one", "two"}, currentDocument[2])
+AssertEquals(3, currentDocument.wordcount)
+AssertEquals(Paragraph, GetClass(currentDocument[2]))
+
+-- Loaded documents are saved normally, and are the same as before.
+
+Cmd.ChangeDocument("third")
+AssertEquals(SaveToFile(filename2, documentSet), true)
+AssertEquals(wg.readfile(filename), wg.readfile(filename2))
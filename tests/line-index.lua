@@ -0,0 +1,75 @@
+--!nonstrict
+loadfile("tests/testsuite.lua")()
+
+-- Works out where every paragraph is from scratch, and checks the line
+-- index against it.
+local function check(doc)
+	local line = 0
+	for pn = 1, #doc do
+		AssertEquals(line, doc:getLineOfParagraph(pn))
+		local height = #doc[pn]:wrap().lines + doc:spaceBelow(pn)
+		for ln = 1, height do
+			AssertTableEquals({pn, ln}, {doc:getParagraphAtLine(line + ln - 1)})
+		end
+		line = line + height
+	end
+	AssertEquals(line, doc:getHeight())
+	AssertTableEquals({#doc, #doc[#doc]:wrap().lines + doc:spaceBelow(#doc) + 3},
+		{doc:getParagraphAtLine(line + 2)})
+end
+
+local styles = {"P", "H1", "P", "LB", "H2", "Q"}
+local function para(i)
+	local words = {}
+	for w = 1, (i * 7) % 13 do
+		words[#words+1] = "word"..w
+	end
+	return CreateParagraph(styles[(i % #styles) + 1], words)
+end
+
+currentDocument:wrap(20)
+currentDocument:deleteParagraphAt(1)
+for i = 1, 50 do
+	currentDocument:appendParagraph(para(i))
+end
+check(currentDocument)
+
+-- Typing changes one paragraph.
+
+currentDocument.cp = 10
+currentDocument.cw = 1
+currentDocument.co = 1
+Cmd.InsertStringIntoParagraph("a very long sentence which wraps onto more lines ")
+check(currentDocument)
+
+-- Changing the style of a paragraph changes the space above it.
+
+Cmd.ChangeParagraphStyle("H1")
+check(currentDocument)
+
+-- Splitting and joining paragraphs inserts and deletes them.
+
+Cmd.SplitCurrentParagraph()
+check(currentDocument)
+Cmd.DeletePreviousChar()
+check(currentDocument)
+
+currentDocument:insertParagraphBefore(para(3), 1)
+currentDocument:setParagraph(2, para(4))
+currentDocument:deleteParagraphAt(#currentDocument)
+check(currentDocument)
+
+-- Rewrapping starts again.
+
+currentDocument:wrap(35)
+check(currentDocument)
+
+-- Changing the style set changes the space between paragraphs.
+
+GlobalSettings.lookandfeel.denseparagraphs = false
+UpdateDocumentStyles()
+check(currentDocument)
+
+GlobalSettings.lookandfeel.denseparagraphs = true
+UpdateDocumentStyles()
+check(currentDocument)
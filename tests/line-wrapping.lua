@@ -46,3 +46,41 @@ AssertTableEquals({5, 6, 7}, wd.lines[3])
 AssertTableEquals({8, 9}, wd.lines[4])
 
 AssertTableEquals({0, 0, 6, 12, 0, 6, 11, 0, 5}, wd.xs)
+
+-- Sentence detection and full stop spacing.
+
+documentStyles["P"].indent = 0
+documentStyles["P"].firstindent = nil
+
+local para = CreateParagraph("P", {"One.", "Two", "three.", "Four", "five", "six."})
+local wd = para:wrap(20)
+AssertTableEquals({1, 2, 3}, wd.lines[1])
+AssertTableEquals({4, 5, 6}, wd.lines[2])
+AssertEquals(4, wd.lines[2].wn)
+AssertTableEquals({0, 5, 9, 0, 5, 10}, wd.xs)
+AssertTableAndPropertiesEquals({[1] = true, [2] = true, [4] = true, [6] = true},
+	wd.sentences)
+
+local oldlookandfeel = GlobalSettings.lookandfeel
+GlobalSettings.lookandfeel = { fullstopspaces = true }
+para._wrapdata = nil
+wd = para:wrap(20)
+AssertTableEquals({0, 6, 10, 0, 5, 10}, wd.xs)
+GlobalSettings.lookandfeel = oldlookandfeel
+
+-- A first word which doesn't fit produces an empty first line.
+
+local para = CreateParagraph("P", {"Supercalifragilistic", "x"})
+local wd = para:wrap(10)
+AssertEquals(3, #wd.lines)
+AssertEquals(0, #wd.lines[1])
+AssertEquals(1, wd.lines[1].wn)
+AssertTableEquals({1}, wd.lines[2])
+AssertTableEquals({2}, wd.lines[3])
+AssertTableEquals({0, 0}, wd.xs)
+
+-- Empty paragraphs have no lines.
+
+local para = CreateParagraph("P")
+local wd = para:wrap(20)
+AssertEquals(0, #wd.lines)
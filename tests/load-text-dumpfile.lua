@@ -0,0 +1,49 @@
+--!nonstrict
+loadfile("tests/testsuite.lua")()
+
+local ds = LoadFromHeaderlessString(
+	".current: 1\r\n" ..
+	".documents.1.name: \"main\"\r\n" ..
+	".documents.1.cp: 2\r\n" ..
+	".documents.1.cw: 1\n" ..
+	".documents.1.co: 1\n" ..
+	".documents.1.viewmode: 1\n" ..
+	".documents.1.wrapwidth: 7.5\n" ..
+	".documents.1.flag: true\n" ..
+	".documents.1.nested.key: \"one\\ntwo\\\"three\"\n" ..
+	".documents.1.nested.3: false\n" ..
+	"\n" ..
+	"#1\n" ..
+	"P one two\r\n" ..
+	"H1 \n" ..
+	"LB\n" ..
+	".\n")
+
+AssertEquals(1, #ds.documents)
+local doc = ds.documents[1]
+AssertEquals(doc, ds.current)
+AssertEquals(doc, ds:findDocument("main"))
+AssertEquals(2, doc.cp)
+AssertEquals(7.5, doc.wrapwidth)
+AssertEquals(true, doc.flag)
+AssertTableAndPropertiesEquals({ key = "one\ntwo\"three", [3] = false }, doc.nested)
+
+AssertEquals(3, #doc)
+AssertTableAndPropertiesEquals({ style = "P", "one", "two" }, doc[1])
+AssertTableAndPropertiesEquals({ style = "H1", "" }, doc[2])
+AssertTableAndPropertiesEquals({ style = "LB" }, doc[3])
+AssertEquals(Paragraph, getmetatable(doc[1]))
+
+-- Malformed files fail with the same messages as they always have.
+
+local ok, e = pcall(LoadFromHeaderlessString, ".documents.1.name \"x\"\n")
+AssertEquals(false, ok)
+AssertNotNull(e:find("malformed line when reading file: '.documents.1.name \"x\"'", 1, true))
+
+ok, e = pcall(LoadFromHeaderlessString, ".documents.1.name: x\n")
+AssertEquals(false, ok)
+AssertNotNull(e:find("malformed property .documents.1.name: x", 1, true))
+
+ok, e = pcall(LoadFromHeaderlessString, "garbage\n")
+AssertEquals(false, ok)
+AssertNotNull(e:find("malformed line when reading file: 'garbage'", 1, true))
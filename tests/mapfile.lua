@@ -0,0 +1,55 @@
+--!nonstrict
+loadfile("tests/testsuite.lua")()
+
+local dir = wg.mkdtemp()
+local filename = dir.."/data"
+
+-- Files are read into strings of exactly the right size.
+
+local data = {}
+for i = 1, 100000 do
+	data[#data+1] = tostring(i)
+end
+data = table.concat(data, "\n")
+AssertEquals(true, wg.writefile(filename, data))
+AssertEquals(data, wg.readfile(filename))
+
+-- Mapped files behave like strings.
+
+local m = wg.mapfile(filename)
+AssertNotNull(m)
+AssertEquals(#data, #m)
+for _, range in {{1}, {1, 10}, {-5}, {-10, -3}, {0, 3}, {5, 2},
+		{#data - 2, #data + 10}, {#data + 5}} do
+	AssertEquals(data:sub(unpack(range)), m:sub(unpack(range)))
+end
+
+AssertEquals(true, wg.writefile(filename..".empty", ""))
+local e = wg.mapfile(filename..".empty")
+AssertEquals(0, #e)
+AssertEquals("", e:sub(1))
+AssertEquals("", wg.readfile(filename..".empty"))
+
+AssertNull(wg.mapfile(dir.."/nonexistent"))
+
+AssertEquals(true, wg.writefile(filename..".z", wg.compress(data)))
+AssertEquals(data, wg.decompress(wg.mapfile(filename..".z")))
+
+-- Document sets are loaded from a mapped file, and lazily loaded
+-- documents keep it (even once the file has been replaced by a save).
+
+Cmd.InsertStringIntoParagraph("fnord")
+Cmd.AddBlankDocument("other")
+Cmd.InsertStringIntoParagraph("blarg")
+local wgname = dir.."/tempfile.wg"
+AssertEquals(Cmd.SaveCurrentDocumentAs(wgname), true)
+local saved = wg.readfile(wgname)
+
+AssertEquals(Cmd.LoadDocumentSet(wgname), true)
+local main = documentSet:findDocument("main")
+AssertEquals(true, main._unloaded)
+AssertEquals("userdata", type(main._source))
+
+AssertEquals(SaveToFile(wgname, documentSet), true)
+AssertEquals(saved, wg.readfile(wgname))
+AssertTableEquals({"fnord"}, main:materialise()[1])
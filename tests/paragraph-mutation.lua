@@ -0,0 +1,41 @@
+--!nonstrict
+loadfile("tests/testsuite.lua")()
+
+-- Freshly created paragraphs are modified in place.
+
+local p = CreateParagraph("P", {"one", "two", "three"})
+AssertEquals(true, p:isMutable())
+AssertEquals(p, p:replaceWord(2, "TWO"))
+AssertTableEquals({"one", "TWO", "three"}, p)
+AssertEquals(p, p:insertWords(2, {"a", "b"}))
+AssertTableEquals({"one", "a", "b", "TWO", "three"}, p)
+AssertEquals(p, p:insertWords(6, {"end"}))
+AssertTableEquals({"one", "a", "b", "TWO", "three", "end"}, p)
+AssertEquals(p, p:removeWords(2, 4))
+AssertTableEquals({"one", "three", "end"}, p)
+AssertEquals("P", p.style)
+
+-- Once frozen (as happens when an undo snapshot is taken), changes are made
+-- to a copy, which is itself mutable.
+
+FreezeParagraphs()
+AssertEquals(false, p:isMutable())
+local q = p:replaceWord(1, "ONE")
+AssertEquals(false, p == q)
+AssertTableEquals({"one", "three", "end"}, p)
+AssertTableEquals({"ONE", "three", "end"}, q)
+AssertEquals("P", q.style)
+AssertEquals(true, q:isMutable())
+AssertEquals(q, q:removeWords(3, 3))
+AssertTableEquals({"ONE", "three"}, q)
+
+-- Typing after a checkpoint mustn't change the snapshot.
+
+Cmd.InsertStringIntoParagraph("foo bar")
+Cmd.Checkpoint()
+local snapshot = currentDocument[1]
+Cmd.InsertStringIntoWord("baz")
+AssertTableEquals({"foo", "bar"}, snapshot)
+AssertTableEquals({"foo", "barbaz"}, currentDocument[1])
+Cmd.Undo()
+AssertTableEquals({"foo", "bar"}, currentDocument[1])
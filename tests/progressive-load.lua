@@ -0,0 +1,52 @@
+--!nonstrict
+loadfile("tests/testsuite.lua")()
+
+-- Make a document set with a document big enough to be loaded progressively.
+
+Cmd.AddBlankDocument("big")
+local COUNT = 30000
+for i = 1, COUNT do
+	currentDocument[i] = CreateParagraph("P",
+		{"paragraph", tostring(i), "with", "some", "words", "to", "pad", "it", "out"})
+end
+currentDocument:invalidateCounts()
+Cmd.ChangeDocument("main")
+
+local dir = wg.mkdtemp()
+local filename = dir.."/tempfile.wg"
+AssertEquals(Cmd.SaveCurrentDocumentAs(filename), true)
+AssertEquals(Cmd.LoadDocumentSet(filename), true)
+
+local big = documentSet:findDocument("big")
+AssertEquals(true, big._unloaded)
+AssertEquals(false, big:isPartial())
+
+-- Only the paragraphs around the one asked for are loaded.
+
+big:materialise(15000)
+AssertEquals(true, big:isPartial())
+AssertEquals(COUNT, #big)
+AssertTableEquals({"paragraph", "15000", "with", "some", "words", "to", "pad", "it", "out"},
+	big[15000])
+AssertEquals(0, #big[1])
+AssertEquals(0, #big[COUNT])
+AssertEquals(Paragraph, GetClass(big[1]))
+
+-- A partial document is saved exactly as it was.
+
+local filename2 = dir.."/tempfile2.wg"
+AssertEquals(SaveToFile(filename2, documentSet), true)
+AssertEquals(wg.readfile(filename), wg.readfile(filename2))
+
+-- Finishing the load fills in the rest.
+
+big:materialise()
+AssertEquals(false, big:isPartial())
+AssertNull(big._unloaded)
+AssertEquals(COUNT, #big)
+AssertTableEquals({"paragraph", "1", "with", "some", "words", "to", "pad", "it", "out"},
+	big[1])
+AssertTableEquals({"paragraph", tostring(COUNT), "with", "some", "words", "to", "pad", "it", "out"},
+	big[COUNT])
+big:renumber()
+AssertEquals(COUNT * 9, big.wordcount)
@@ -0,0 +1,104 @@
+--!nonstrict
+loadfile("tests/testsuite.lua")()
+
+-- Only the cells which have changed since the last sync are drawn, a run
+-- of cells with the same attributes at a time.
+
+wg.initfakescreen(20, 2)
+local function run(x, y, attr, pair, text)
+	return { x = x, y = y, attr = attr, pair = pair, text = text }
+end
+
+AssertEquals(2, #wg.sync())
+AssertTableAndPropertiesEquals({}, wg.sync())
+
+wg.write(2, 1, "fnord")
+AssertTableAndPropertiesEquals({run(2, 1, 0, 0, "fnord")}, wg.sync())
+wg.write(2, 1, "fnord")
+AssertTableAndPropertiesEquals({}, wg.sync())
+
+-- Runs are split where the attributes or colours change.
+
+wg.write(0, 0, "ab")
+wg.setbold()
+wg.write(2, 0, "cd")
+wg.setnormal()
+AssertTableAndPropertiesEquals({
+	run(0, 0, 0, 0, "ab"),
+	run(2, 0, wg.BOLD, 0, "cd"),
+}, wg.sync())
+
+wg.setcolour({1, 0, 0}, {0, 0, 0})
+wg.write(0, 0, "x")
+wg.setcolour({0, 1, 0}, {0, 0, 0})
+wg.write(1, 0, "y")
+wg.setcolour({1, 0, 0}, {0, 0, 0})
+wg.write(2, 0, "z")
+AssertTableAndPropertiesEquals({
+	run(0, 0, 0, 1, "x"),
+	run(1, 0, 0, 2, "y"),
+	run(2, 0, 0, 1, "z"),
+}, wg.sync())
+
+-- Overwriting either half of a double-width character replaces the other
+-- half with a space.
+
+wg.cleararea(0, 0, 19, 1)
+wg.sync()
+wg.write(0, 0, "世")
+wg.write(4, 0, "世")
+AssertTableAndPropertiesEquals({
+	run(0, 0, 0, 1, "世"),
+	run(4, 0, 0, 1, "世"),
+}, wg.sync())
+
+wg.write(1, 0, "a")
+wg.write(4, 0, "b")
+AssertTableAndPropertiesEquals({
+	run(0, 0, 0, 1, " a"),
+	run(4, 0, 0, 1, "b "),
+}, wg.sync())
+
+-- Combining characters go in the same cell as the one before.
+
+wg.write(0, 1, "e\u{301}x")
+AssertTableAndPropertiesEquals({run(0, 1, 0, 1, "e\u{301}x")}, wg.sync())
+
+-- Styled words are drawn with their style bytes as attributes.
+
+wg.initfakescreen(20, 1)
+wg.sync()
+local bold = wg.createstylebyte(wg.BOLD)
+local plain = wg.createstylebyte(0)
+AssertEquals(0, wg.writestyled(0, 0, "ab"..bold.."cd"..plain.."ef", 0, 0, 0, 0))
+AssertTableAndPropertiesEquals({
+	run(0, 0, 0, 0, "ab"),
+	run(2, 0, wg.BOLD, 0, "cd"),
+	run(4, 0, 0, 0, "ef"),
+}, wg.sync())
+
+-- A line of a paragraph is drawn with the decorations of each word, and a
+-- mark which spans several words.
+
+wg.cleararea(0, 0, 19, 0)
+wg.sync()
+local words = {"one", "two", "three"}
+wg.writeline(0, 0, words, {0, 4, 8}, {1, 2, 3}, 0, {[2] = wg.DIM}, 1, 2, 3, 3)
+AssertTableAndPropertiesEquals({
+	run(0, 0, 0, 0, "o"),
+	run(1, 0, wg.REVERSE, 0, "ne"),
+	run(4, 0, wg.DIM + wg.REVERSE, 0, "two"),
+	run(8, 0, wg.REVERSE, 0, "th"),
+	run(10, 0, 0, 0, "ree"),
+}, wg.sync())
+
+-- Where the mark runs on between words, the space is marked too.
+
+wg.cleararea(0, 0, 19, 0)
+wg.sync()
+wg.writeline(0, 0, words, {0, 4, 8}, {1, 2, 3}, 0, nil, 1, 2, 3, 3)
+AssertTableAndPropertiesEquals({
+	run(0, 0, 0, 0, "o"),
+	run(1, 0, wg.REVERSE, 0, "ne\u{a0}two\u{a0}th"),
+	run(10, 0, 0, 0, "ree"),
+}, wg.sync())
@@ -19,34 +19,26 @@ Cmd.DeleteWord()
 Cmd.AddToUserDictionary()
 AssertTableEquals({"fnord"}, unset(GetUserDictionary()))
 
+local function decorate(word)
+	local payload = {
+		paragraph = CreateParagraph("P", word),
+		sentences = {},
+		decorations = {}
+	}
+	FireEvent("DecorateParagraph", payload)
+	return payload.decorations[1] or 0
+end
+
 documentSet.addons.spellchecker.enabled = false
-local payload = { word="fnord", cstyle=0, ostyle=0 }
-FireEvent("DrawWord", payload)
-AssertTableEquals({"fnord", 0, 0},
-	{payload.word, payload.cstyle, payload.ostyle})
+AssertEquals(0, decorate("fnord"))
 
 documentSet.addons.spellchecker.enabled = true
 documentSet.addons.spellchecker.useuserdictionary = true
 documentSet.addons.spellchecker.usesystemdictionary = false
-local payload = { word="fnord", cstyle=0, ostyle=0 }
-FireEvent("DrawWord", payload)
-AssertTableEquals({"fnord", 0, 0},
-	{payload.word, payload.cstyle, payload.ostyle})
-
-local payload = { word="fnord.", cstyle=0, ostyle=0 }
-FireEvent("DrawWord", payload)
-AssertTableEquals({"fnord.", 0, 0},
-	{payload.word, payload.cstyle, payload.ostyle})
-
-local payload = { word="There’s", cstyle=0, ostyle=0 }
-FireEvent("DrawWord", payload)
-AssertTableEquals({"There’s", wg.DIM, 0},
-	{payload.word, payload.cstyle, payload.ostyle})
-
-local payload = { word="notfound", cstyle=0, ostyle=0 }
-FireEvent("DrawWord", payload)
-AssertTableEquals({"notfound", wg.DIM, 0},
-	{payload.word, payload.cstyle, payload.ostyle})
+AssertEquals(0, decorate("fnord"))
+AssertEquals(0, decorate("fnord."))
+AssertEquals(wg.DIM, decorate("There’s"))
+AssertEquals(wg.DIM, decorate("notfound"))
 
 documentSet.addons.spellchecker.enabled = true
 documentSet.addons.spellchecker.useuserdictionary = true
@@ -74,10 +66,39 @@ AssertEquals(false, IsWordMisspelt("There’s", true))
 
 documentSet.addons.spellchecker.useuserdictionary = true
 documentSet.addons.spellchecker.usesystemdictionary = true
-local payload = { word="fnord", cstyle=0, ostyle=0 }
-FireEvent("DrawWord", payload)
-AssertTableEquals({"fnord", 0, 0},
-	{payload.word, payload.cstyle, payload.ostyle})
+AssertEquals(0, decorate("fnord"))
+
+-- Decorations are cached until the paragraph changes.
+
+local p = CreateParagraph("P", "fnord", "notfound")
+local d = p:getDecorations()
+AssertNull(d[1])
+AssertEquals(wg.DIM, d[2])
+AssertEquals(d, p:getDecorations())
+
+p = p:replaceWord(1, "notfound")
+AssertTableEquals({wg.DIM, wg.DIM}, p:getDecorations())
+
+documentSet.addons.spellchecker.enabled = false
+AssertTableEquals({wg.DIM, wg.DIM}, p:getDecorations())
+InvalidateDecorations()
+AssertTableEquals({}, p:getDecorations())
+documentSet.addons.spellchecker.enabled = true
+
+-- Listeners for the old DrawWord event are still asked about each word.
+
+documentSet.addons.spellchecker.enabled = false
+local token = AddEventListener("DrawWord",
+	function(event, token, payload)
+		if payload.word == "fnord" then
+			payload.cstyle = bit32.bor(payload.cstyle, wg.BOLD)
+		end
+	end)
+InvalidateDecorations()
+AssertTableEquals({wg.BOLD}, CreateParagraph("P", "fnord", "other"):getDecorations())
+RemoveEventListener(token)
+InvalidateDecorations()
+documentSet.addons.spellchecker.enabled = true
 
 -- FindNextMisspeltWord
 
@@ -0,0 +1,75 @@
+--!nonstrict
+loadfile("tests/testsuite.lua")()
+
+local function contents()
+	local t = {}
+	for _, p in ipairs(currentDocument) do
+		t[#t+1] = p.style..":"..p:asString()
+	end
+	return t
+end
+
+-- Structural changes are undone and redone.
+
+Cmd.InsertStringIntoParagraph("one")
+Cmd.Checkpoint()
+Cmd.SplitCurrentParagraph()
+Cmd.InsertStringIntoParagraph("two")
+Cmd.ChangeParagraphStyle("LN")
+local state1 = contents()
+
+Cmd.Checkpoint()
+currentDocument.cp = 1
+Cmd.JoinWithNextParagraph()
+currentDocument:appendParagraph(CreateParagraph("P", {"three"}))
+currentDocument:deleteParagraphAt(1)
+local state2 = contents()
+AssertTableEquals({"P:three"}, state2)
+
+Cmd.Undo()
+AssertTableEquals(state1, contents())
+Cmd.Undo()
+AssertTableEquals({"P:one"}, contents())
+AssertEquals(false, Cmd.Undo())
+Cmd.Redo()
+AssertTableEquals(state1, contents())
+Cmd.Redo()
+AssertTableEquals(state2, contents())
+AssertEquals(false, Cmd.Redo())
+
+-- The word count follows along.
+
+FireEvent("Changed")
+AssertEquals(1, currentDocument.wordcount)
+Cmd.Undo()
+FireEvent("Changed")
+AssertEquals(2, currentDocument.wordcount)
+
+-- Changes made without a checkpoint are undone along with the rest.
+
+currentDocument:appendParagraph(CreateParagraph("P", {"four"}))
+Cmd.Undo()
+AssertTableEquals({"P:one"}, contents())
+Cmd.Redo()
+AssertTableEquals({"P:one", "LN:two", "P:four"}, contents())
+Cmd.Undo()
+AssertTableEquals({"P:one"}, contents())
+
+-- Checkpoints with no changes in between don't add to the stack, and the
+-- stack forgets its oldest entries.
+
+Cmd.Checkpoint()
+local depth = #currentDocument._undostack
+Cmd.Checkpoint()
+AssertEquals(depth, #currentDocument._undostack)
+
+for i = 1, 600 do
+	currentDocument:appendParagraph(CreateParagraph("P", {tostring(i)}))
+	Cmd.Checkpoint()
+end
+AssertEquals(500, #currentDocument._undostack)
+for i = 1, 500 do
+	AssertEquals(true, Cmd.Undo())
+end
+AssertEquals(102, #currentDocument)
+AssertEquals(false, Cmd.Undo())
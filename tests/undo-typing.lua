@@ -0,0 +1,90 @@
+--!nonstrict
+loadfile("tests/testsuite.lua")()
+
+local function typeString(s)
+	for c in s:gmatch(".") do
+		if c == " " then
+			Cmd.Checkpoint()
+			Cmd.SplitCurrentWord()
+		else
+			Cmd.CheckpointTyping()
+			Cmd.InsertStringIntoWord(c)
+		end
+	end
+end
+
+local function text()
+	return currentDocument[1]:asString()
+end
+
+-- Typing into a word is a single undo step, and after the first keystroke
+-- the paragraph is modified in place.
+
+typeString("one")
+local p = currentDocument[1]
+typeString("two")
+AssertEquals(p, currentDocument[1])
+AssertEquals("onetwo", text())
+AssertEquals(1, #currentDocument._undostack)
+
+-- Moving the cursor starts a new step.
+
+currentDocument.co = 1
+typeString("X")
+AssertEquals("Xonetwo", text())
+AssertEquals(2, #currentDocument._undostack)
+
+-- So do spaces.
+
+currentDocument.co = #currentDocument[1][1] + 1
+typeString(" three four")
+AssertEquals(6, #currentDocument._undostack)
+
+Cmd.Undo()
+AssertEquals("Xonetwo three ", text())
+Cmd.Undo()
+AssertEquals("Xonetwo three", text())
+Cmd.Undo()
+AssertEquals("Xonetwo ", text())
+Cmd.Undo()
+AssertEquals("Xonetwo", text())
+Cmd.Undo()
+AssertEquals("onetwo", text())
+Cmd.Undo()
+AssertEquals("", text())
+AssertEquals(false, Cmd.Undo())
+
+Cmd.Redo()
+Cmd.Redo()
+AssertEquals("Xonetwo", text())
+
+-- Memory use is tracked.
+
+AssertEquals(true, currentDocument._undostack.bytes > 0)
+local bytes = 0
+for _, e in currentDocument._undostack.entries do
+	bytes = bytes + e.bytes
+end
+AssertEquals(bytes, currentDocument._undostack.bytes)
+
+-- The oldest steps are forgotten once the history uses more than its memory
+-- budget. (Every use of a word is counted, so one big word will do.)
+
+local big = string.rep("x", 1024 * 1024)
+local words = table.create(8, big)
+for i = 1, 10 do
+	Cmd.Checkpoint()
+	currentDocument:setParagraph(1, CreateParagraph("P", "step"..i, unpack(words)))
+end
+AssertEquals(true, currentDocument._undostack.bytes <= (32 * 1024 * 1024))
+AssertEquals(true, #currentDocument._undostack < 10)
+
+Cmd.Undo()
+AssertEquals("step9", currentDocument[1][1])
+Cmd.Undo()
+AssertEquals("step8", currentDocument[1][1])
+while Cmd.Undo() do
+end
+local oldest = tonumber(currentDocument[1][1]:match("^step(%d+)$"))
+AssertNotNull(oldest)
+AssertEquals(true, oldest > 1)
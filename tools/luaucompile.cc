@@ -0,0 +1,56 @@
+/* © 2025 David Given.
+ * WordGrinder is licensed under the MIT open source license. See the COPYING
+ * file in this distribution for the full text.
+ */
+
+/* Compiles a Lua source file into Luau bytecode, for embedding into the
+ * binary by multibin2c.sh. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sstream>
+#include <fstream>
+#include "luauoptions.h"
+
+int main(int argc, const char* argv[])
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "Usage: %s <input.lua> <output.luauc>\n", argv[0]);
+        exit(1);
+    }
+
+    std::ifstream in(argv[1], std::ios::binary);
+    if (!in)
+    {
+        perror(argv[1]);
+        exit(1);
+    }
+
+    std::stringstream ss;
+    ss << in.rdbuf();
+
+    std::string bytecode = Luau::compile(ss.str(), copts(), popts());
+
+    /* A leading zero byte means that compilation failed, and the rest of the
+     * data is the error message. */
+
+    if (bytecode.empty() || (bytecode[0] == 0))
+    {
+        fprintf(stderr,
+            "%s: %s\n",
+            argv[1],
+            bytecode.empty() ? "compilation failed" : bytecode.c_str() + 1);
+        exit(1);
+    }
+
+    std::ofstream out(argv[2], std::ios::binary);
+    out.write(bytecode.data(), bytecode.size());
+    if (!out)
+    {
+        perror(argv[2]);
+        exit(1);
+    }
+
+    return 0;
+}
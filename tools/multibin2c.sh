@@ -7,6 +7,15 @@ set -e
 
 output="$1"
 shift
+
+# If -c is given, each file is run through the supplied compiler first and
+# the result is embedded instead of the raw source.
+compiler=
+if [ "$1" = "-c" ]; then
+	compiler="$2"
+	shift 2
+fi
+
 self="$1"
 shift
 objectify="$1"
@@ -24,7 +33,12 @@ count=0
 for f in "$@"; do
 	out
 	out "/* This is $f */"
-	python3 "$objectify" $f file_$count >>"$output"
+	if [ -n "$compiler" ]; then
+		"$compiler" "$f" "$output.tmp"
+		python3 "$objectify" "$output.tmp" file_$count >>"$output"
+	else
+		python3 "$objectify" $f file_$count >>"$output"
+	fi
 	count=$(expr $count + 1)
 done
 
@@ -36,3 +50,4 @@ for f in "$@"; do
 done
 out "  {}"
 out "};"
+rm -f "$output.tmp"